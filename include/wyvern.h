@@ -0,0 +1,51 @@
+/// Annotations that direct lazification at the source level. Each annotation
+/// is attached to a function declaration or definition and receives the
+/// zero-based indices of the parameters it applies to:
+///
+///   WYVERN_LAZY(2) void log_msg(int level, const char *fmt, const char *msg);
+///
+///   - WYVERN_LAZY: the parameters are cheap to defer and are candidates for
+///     lazification, even in calls to functions whose body is not visible.
+///   - WYVERN_ALWAYS_LAZY: the parameters are lazified whenever it is safe,
+///     regardless of the static analysis or the profile.
+///   - WYVERN_EAGER: the parameters are never lazified.
+///
+/// Annotations are lowered to llvm.global.annotations through the annotate
+/// attribute. Clang only emits the annotations of definitions, so functions
+/// whose body is in another translation unit are annotated with the _DECL
+/// variants instead, next to their prototype:
+///
+///   void log_msg(int level, const char *fmt, const char *msg);
+///   WYVERN_LAZY_DECL(log_msg, 2);
+///
+/// These define a marker variable that points to the function and carries
+/// the annotation. When the pass sees a definition with lazy parameters, it
+/// emits an entry point that receives them as thunks, so that calls from
+/// other translation units, where only the declaration is visible, can still
+/// be lazified.
+///
+//===----------------------------------------------------------------------===//
+#ifndef WYVERN_H
+#define WYVERN_H
+
+#define WYVERN_LAZY(...) __attribute__((annotate("wyvern_lazy:" #__VA_ARGS__)))
+
+#define WYVERN_ALWAYS_LAZY(...)                                                \
+  __attribute__((annotate("wyvern_always_lazy:" #__VA_ARGS__)))
+
+#define WYVERN_EAGER(...)                                                      \
+  __attribute__((annotate("wyvern_eager:" #__VA_ARGS__)))
+
+#define WYVERN_ANNOTATE_DECL(kind, fn, ...)                                    \
+  static void (*const _wyvern_##kind##_##fn)(void)                             \
+      __attribute__((used, annotate("wyvern_" #kind ":" #__VA_ARGS__))) =      \
+          (void (*)(void))&fn
+
+#define WYVERN_LAZY_DECL(fn, ...) WYVERN_ANNOTATE_DECL(lazy, fn, __VA_ARGS__)
+
+#define WYVERN_ALWAYS_LAZY_DECL(fn, ...)                                       \
+  WYVERN_ANNOTATE_DECL(always_lazy, fn, __VA_ARGS__)
+
+#define WYVERN_EAGER_DECL(fn, ...) WYVERN_ANNOTATE_DECL(eager, fn, __VA_ARGS__)
+
+#endif // WYVERN_H
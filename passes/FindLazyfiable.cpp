@@ -14,7 +14,8 @@
 using namespace llvm;
 
 void FindLazyfiableAnalysis::DFS(BasicBlock *first, BasicBlock *exit,
-                                 std::set<BasicBlock *> &visited, Value *arg,
+                                 std::set<BasicBlock *> &visited,
+                                 function_ref<bool(Instruction &)> isUse,
                                  int index) {
   std::stack<BasicBlock *> st;
   st.push(first);
@@ -28,12 +29,8 @@ void FindLazyfiableAnalysis::DFS(BasicBlock *first, BasicBlock *exit,
       if (isa<PHINode>(I)) {
         continue;
       }
-      for (Use &U : I.operands()) {
-        if (Value *vUse = dyn_cast<Value>(U)) {
-          if (vUse == arg) {
-            hasUse = true;
-          }
-        }
+      if (isUse(I)) {
+        hasUse = true;
       }
     }
 
@@ -79,23 +76,41 @@ void FindLazyfiableAnalysis::findLazyfiablePaths(Function &F) {
   for (auto &arg : F.args()) {
     std::set<BasicBlock *> visited;
     if (Value *vArg = dyn_cast<Value>(&arg)) {
-      DFS(&entry, exit, visited, vArg, index);
+      DFS(&entry, exit, visited,
+          [vArg](Instruction &I) { return is_contained(I.operands(), vArg); },
+          index);
     }
     ++index;
   }
+
+  // Variadic arguments can only be read after va_start, so all of them share
+  // a single slot, indexed right after the last formal parameter.
+  if (F.isVarArg()) {
+    std::set<BasicBlock *> visited;
+    DFS(&entry, exit, visited,
+        [](Instruction &I) { return isa<VAStartInst>(&I); }, index);
+  }
 }
 
 bool FindLazyfiableAnalysis::isArgumentComplex(Instruction &I) { return true; }
 
 void FindLazyfiableAnalysis::analyzeCall(CallInst *CI) {
   Function *Callee = CI->getCalledFunction();
-  if (Callee == nullptr || Callee->isDeclaration()) {
+  if (Callee == nullptr) {
     return;
   }
 
   for (auto &arg : CI->args()) {
     if (Instruction *I = dyn_cast<Instruction>(&arg)) {
       unsigned int index = CI->getArgOperandNo(&arg);
+      // Calls to functions with no body can only be lazified through the
+      // entry points generated for annotated parameters
+      if (Callee->isDeclaration() && !isAnnotatedLazy(Callee, index)) {
+        continue;
+      }
+      if (isAnnotatedEager(Callee, index)) {
+        continue;
+      }
       if (isArgumentComplex(*I)) {
         auto pair = std::make_pair(Callee, index);
         _lazyfiableCallSitesStats.insert(pair);
@@ -105,6 +120,86 @@ void FindLazyfiableAnalysis::analyzeCall(CallInst *CI) {
   }
 }
 
+/// Parses the list of comma-separated parameter indices in @param indices,
+/// inserting a pair (@param F, index) in @param annotatedArgs for each of them.
+static void
+parseAnnotatedIndices(Function *F, StringRef indices,
+                      std::set<std::pair<Function *, int>> &annotatedArgs) {
+  SmallVector<StringRef> indexStrs;
+  indices.split(indexStrs, ',', -1, false);
+  for (StringRef indexStr : indexStrs) {
+    unsigned index;
+    if (indexStr.trim().getAsInteger(10, index) || index >= F->arg_size()) {
+      errs() << "Ignoring invalid parameter index in Wyvern annotation of "
+             << F->getName() << ": " << indexStr << "\n";
+      continue;
+    }
+    annotatedArgs.insert(std::make_pair(F, index));
+  }
+}
+
+void FindLazyfiableAnalysis::collectAnnotations(Module &M) {
+  GlobalVariable *annotations = M.getGlobalVariable("llvm.global.annotations");
+  if (!annotations || !annotations->hasInitializer()) {
+    return;
+  }
+
+  ConstantArray *entries =
+      dyn_cast<ConstantArray>(annotations->getInitializer());
+  if (!entries) {
+    return;
+  }
+
+  // Each entry has the form { annotated value, annotation, file, line, args }
+  for (Value *op : entries->operands()) {
+    ConstantStruct *entry = dyn_cast<ConstantStruct>(op);
+    if (!entry || entry->getNumOperands() < 2) {
+      continue;
+    }
+
+    // Functions that are only declared are annotated through a marker
+    // variable that points to them (see WYVERN_LAZY_DECL)
+    Value *annotated = entry->getOperand(0)->stripPointerCasts();
+    if (GlobalVariable *marker = dyn_cast<GlobalVariable>(annotated)) {
+      if (marker->hasInitializer()) {
+        annotated = marker->getInitializer()->stripPointerCasts();
+      }
+    }
+    Function *F = dyn_cast<Function>(annotated);
+    GlobalVariable *annotationStr =
+        dyn_cast<GlobalVariable>(entry->getOperand(1)->stripPointerCasts());
+    if (!F || !annotationStr || !annotationStr->hasInitializer()) {
+      continue;
+    }
+
+    ConstantDataArray *strData =
+        dyn_cast<ConstantDataArray>(annotationStr->getInitializer());
+    if (!strData || !strData->isCString()) {
+      continue;
+    }
+
+    auto [kind, indices] = strData->getAsCString().split(':');
+    if (kind == "wyvern_lazy") {
+      parseAnnotatedIndices(F, indices, _lazyAnnotatedArgs);
+    } else if (kind == "wyvern_always_lazy") {
+      parseAnnotatedIndices(F, indices, _alwaysLazyAnnotatedArgs);
+    } else if (kind == "wyvern_eager") {
+      parseAnnotatedIndices(F, indices, _eagerAnnotatedArgs);
+    }
+  }
+}
+
+void FindLazyfiableAnalysis::applyAnnotations() {
+  for (auto &pair : getLazyAnnotatedArgs()) {
+    _promisingFunctions.insert(pair.first);
+    _promisingFunctionArgs.insert(pair);
+  }
+
+  for (auto &pair : _eagerAnnotatedArgs) {
+    _promisingFunctionArgs.erase(pair);
+  }
+}
+
 /// Removes dummy functions in dummyFunctions from the Module.
 /// These functions are added by addMissingUses.
 static void removeDummyFunctions(std::set<Function *> dummyFunctions) {
@@ -203,11 +298,12 @@ void runRequiredPasses(Module &M) {
 
 bool FindLazyfiableAnalysis::runOnModule(Module &M) {
   runRequiredPasses(M);
+  collectAnnotations(M);
 
   std::set<Function *> dummyFunctions = addMissingUses(M, M.getContext());
 
   for (Function &F : M) {
-    if (F.isDeclaration() || F.isVarArg()) {
+    if (F.isDeclaration()) {
       continue;
     }
 
@@ -221,6 +317,7 @@ bool FindLazyfiableAnalysis::runOnModule(Module &M) {
   }
 
   removeDummyFunctions(dummyFunctions);
+  applyAnnotations();
 
   dump_results();
 
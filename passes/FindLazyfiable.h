@@ -22,6 +22,7 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
@@ -48,6 +49,45 @@ public:
     return _promisingFunctionArgs;
   }
 
+  /// Returns whether the actual parameter of index @param index is promising
+  /// in calls to @param F. For variadic functions, every index past the last
+  /// formal parameter refers to the same variadic slot, which is promising if
+  /// there is a path that does not reach va_start.
+  bool isPromisingFunctionArg(Function *F, unsigned index) {
+    if (F->isVarArg() && index > F->arg_size()) {
+      index = F->arg_size();
+    }
+    return _promisingFunctionArgs.count(std::make_pair(F, index)) > 0;
+  }
+
+  /// Returns whether parameter @param index of @param F was annotated with
+  /// WYVERN_LAZY or WYVERN_ALWAYS_LAZY (see wyvern.h).
+  bool isAnnotatedLazy(Function *F, unsigned index) {
+    return _lazyAnnotatedArgs.count(std::make_pair(F, index)) > 0 ||
+           isAnnotatedAlwaysLazy(F, index);
+  }
+
+  /// Returns whether parameter @param index of @param F was annotated with
+  /// WYVERN_ALWAYS_LAZY (see wyvern.h).
+  bool isAnnotatedAlwaysLazy(Function *F, unsigned index) {
+    return _alwaysLazyAnnotatedArgs.count(std::make_pair(F, index)) > 0;
+  }
+
+  /// Returns whether parameter @param index of @param F was annotated with
+  /// WYVERN_EAGER (see wyvern.h).
+  bool isAnnotatedEager(Function *F, unsigned index) {
+    return _eagerAnnotatedArgs.count(std::make_pair(F, index)) > 0;
+  }
+
+  /// Returns the set of (function, parameter) pairs annotated as lazy, either
+  /// with WYVERN_LAZY or WYVERN_ALWAYS_LAZY.
+  std::set<std::pair<Function *, int>> getLazyAnnotatedArgs() {
+    std::set<std::pair<Function *, int>> lazyArgs = _lazyAnnotatedArgs;
+    lazyArgs.insert(_alwaysLazyAnnotatedArgs.begin(),
+                    _alwaysLazyAnnotatedArgs.end());
+    return lazyArgs;
+  }
+
   /// Returns the set of (call, argument) lazifiable callsites. Each pair is a
   /// call instruction, plus the index of its lazifiable actual parameter.
   const std::set<std::pair<CallInst *, int>> &getLazyfiableCallSites() {
@@ -68,6 +108,27 @@ private:
   /// Stores the number of (callsite, lazifiable_argument) occurrences, used
   std::set<std::pair<Function *, int>> _lazyfiableCallSitesStats;
 
+  /// Stores the (function, parameter) pairs annotated in the source code with
+  /// WYVERN_LAZY, WYVERN_ALWAYS_LAZY and WYVERN_EAGER, respectively.
+  std::set<std::pair<Function *, int>> _lazyAnnotatedArgs;
+  std::set<std::pair<Function *, int>> _alwaysLazyAnnotatedArgs;
+  std::set<std::pair<Function *, int>> _eagerAnnotatedArgs;
+
+  /**
+   * Reads the wyvern.h annotations of module @param M, which clang lowers
+   * into the llvm.global.annotations array.
+   *
+   */
+  void collectAnnotations(Module &M);
+
+  /**
+   * Updates the set of promising functions according to the source
+   * annotations: lazy parameters become promising, and eager parameters
+   * are never promising.
+   *
+   */
+  void applyAnnotations();
+
   /**
    * Traverses the module @param M, adding explicit uses of
    * values which are used in PHINodes. This ensures implicit
@@ -80,18 +141,20 @@ private:
   /**
    * Performs a Depth-First Search over a function's CFG, attempting
    * to find paths from entry BB @param first to exit BB @param exit
-   * which do not go through any use of argument @param arg.
+   * which do not go through any instruction for which @param isUse holds.
    *
    * If any such path is found, record them in the analysis' results
    * and statistics.
    *
    */
-  void DFS(BasicBlock *, BasicBlock *, std::set<BasicBlock *> &, Value *, int);
+  void DFS(BasicBlock *, BasicBlock *, std::set<BasicBlock *> &,
+           function_ref<bool(Instruction &)>, int);
 
   /**
    * Searches for lazyfiable paths in function @param F, by
    * checking whether there are paths in its CFG which do not
-   * use each of its input arguments.
+   * use each of its input arguments. For variadic functions, the
+   * variadic arguments are used wherever va_start is called.
    *
    */
   void findLazyfiablePaths(Function &);
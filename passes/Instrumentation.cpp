@@ -2,6 +2,7 @@
 
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
@@ -74,8 +75,9 @@ void WyvernInstrumentationPass::InstrumentCallSites(
           builder.getContext(), llvm::APInt(64, instr_ids[CB], true));
       ConstantInt *numArgs = ConstantInt::get(
           builder.getContext(), llvm::APInt(8, CB->arg_size(), true));
-      CallInst *initCall =
-          builder.CreateCall(initCallFun, {callerName, callInstId, numArgs});
+      CallInst *initCall = builder.CreateCall(
+          CB->isIndirectCall() ? initICallFun : initCallFun,
+          {callerName, callInstId, numArgs});
       updateDebugInfo(initCall, F);
     }
   }
@@ -100,6 +102,16 @@ void WyvernInstrumentationPass::InstrumentFunction(
     Function *F, std::map<Instruction *, int64_t> instr_ids,
     std::shared_ptr<std::set<Function *>> promising) {
 
+  // Functions that may be reached through function pointers record themselves
+  // as targets of the active indirect callsite, for indirect call promotion.
+  if (F->hasAddressTaken()) {
+    IRBuilder<> builder(&*(F->getEntryBlock().getFirstInsertionPt()));
+    Constant *calleeName =
+        builder.CreateGlobalStringPtr(F->getName(), "_wyinstr_callee_name");
+    CallInst *markTargetCall = builder.CreateCall(markTargetFun, {calleeName});
+    updateDebugInfo(markTargetCall, F);
+  }
+
   for (BasicBlock &BB : *F) {
     for (Instruction &I : BB) {
       if (ReturnInst *RI = dyn_cast<ReturnInst>(&I)) {
@@ -134,6 +146,17 @@ void WyvernInstrumentationPass::InstrumentFunction(
 
   inst_iterator I = inst_begin(F);
   for (inst_iterator E = inst_end(F); I != E; ++I) {
+    // variadic arguments are only accessible after va_start
+    if (isa<VAStartInst>(&*I)) {
+      IRBuilder<> builder(&*I);
+      ConstantInt *firstVarArg =
+          ConstantInt::get(F->getParent()->getContext(),
+                           llvm::APInt(8, F->arg_size(), true));
+      CallInst *markCall =
+          builder.CreateCall(markVarArgsFun, {firstVarArg, usedBits});
+      updateDebugInfo(markCall, F);
+    }
+
     for (Use &U : I->operands()) {
       if (auto *V = dyn_cast<Value>(&U)) {
         // instrument uses of arguments to mark that they were evaluated
@@ -218,12 +241,20 @@ bool WyvernInstrumentationPass::runOnModule(Module &M) {
   markFun =
       M.getOrInsertFunction("_wyinstr_mark_eval", Type::getVoidTy(Ctx),
                             Type::getInt8Ty(Ctx), Type::getInt64PtrTy(Ctx));
+  markVarArgsFun =
+      M.getOrInsertFunction("_wyinstr_mark_vaeval", Type::getVoidTy(Ctx),
+                            Type::getInt8Ty(Ctx), Type::getInt64PtrTy(Ctx));
   dumpFun = M.getOrInsertFunction("_wyinstr_dump", Type::getVoidTy(Ctx),
                                   Type::getInt8PtrTy(Ctx));
   endCallFun = M.getOrInsertFunction("_wyinstr_end_call", Type::getVoidTy(Ctx));
   initCallFun = M.getOrInsertFunction(
       "_wyinstr_init_call", Type::getVoidTy(Ctx), Type::getInt8PtrTy(Ctx),
       Type::getInt64Ty(Ctx), Type::getInt8Ty(Ctx));
+  initICallFun = M.getOrInsertFunction(
+      "_wyinstr_init_icall", Type::getVoidTy(Ctx), Type::getInt8PtrTy(Ctx),
+      Type::getInt64Ty(Ctx), Type::getInt8Ty(Ctx));
+  markTargetFun = M.getOrInsertFunction(
+      "_wyinstr_mark_target", Type::getVoidTy(Ctx), Type::getInt8PtrTy(Ctx));
   initProfFun =
       M.getOrInsertFunction("_wyinstr_init_prof", Type::getVoidTy(Ctx));
 
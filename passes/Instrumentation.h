@@ -31,6 +31,11 @@ struct WyvernInstrumentationPass : public ModulePass {
   /// evaluated.
   FunctionCallee markFun;
 
+  /// The _wyinstr_mark_vaeval(int8_t first_index, int64_t *bits) function. It
+  /// is inserted at each va_start, and marks every variadic argument of the
+  /// active call, starting at index first_index, as evaluated.
+  FunctionCallee markVarArgsFun;
+
   /// The _wyinstr_dump() function. Called at the exit points of the program to
   /// dump the results of the profiling.
   FunctionCallee dumpFun;
@@ -41,6 +46,16 @@ struct WyvernInstrumentationPass : public ModulePass {
   /// well as update the number of times the callsite has been called.
   FunctionCallee initCallFun;
 
+  /// The _wyinstr_init_icall(char *fun_name, int64_t call_id, int8_t num_args)
+  /// function. Same as _wyinstr_init_call, but inserted before indirect
+  /// callsites, so that the runtime also records which functions they reach.
+  FunctionCallee initICallFun;
+
+  /// The _wyinstr_mark_target(char *fun_name) function. It is inserted at the
+  /// entry of every address-taken function, and records the function as the
+  /// target of the indirect callsite on top of the shadow call stack.
+  FunctionCallee markTargetFun;
+
   /// The _wyinstr_end_call() function. It is inserted at the exit point of
   /// every instrumented function, and updates the shadow call stack to reflect
   /// that the function has returned.
@@ -1,17 +1,31 @@
+#include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/BasicAliasAnalysis.h"
+#include "llvm/Analysis/CFG.h"
 #include "llvm/Analysis/CFLSteensAliasAnalysis.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/GlobalsModRef.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/InstCombine/InstCombine.h"
 #include "llvm/Transforms/Utils.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/CallPromotionUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
 #include "llvm/Transforms/Utils/Local.h"
 
 #include "DebugUtils.h"
@@ -19,8 +33,12 @@
 #include "Lazyfication.h"
 #include "ProgramSlice.h"
 
+#include <chrono>
 #include <fstream>
-#include <random>
+#include <functional>
+#include <numeric>
+#include <sstream>
+#include <stack>
 
 #define DEBUG_TYPE "WyvernLazyficationPass"
 
@@ -34,14 +52,52 @@ STATISTIC(SmallestSliceSize,
           "Size of smallest slice generated for lazification.");
 STATISTIC(TotalSliceSize,
           "Cumulative size of all slices generated for lazification.");
+STATISTIC(NumThunksForwarded,
+          "The number of thunks forwarded from a callee clone to another.");
+STATISTIC(NumIndirectCallsPromoted,
+          "The number of indirect callsites promoted to guarded direct calls.");
+STATISTIC(NumThunksExceedingCacheLine,
+          "The number of thunks whose layout does not fit in a 64-byte cache "
+          "line.");
+STATISTIC(NumRegisterThunks,
+          "The number of lazified callsites that pass their thunk environment "
+          "in registers.");
+STATISTIC(NumCallByNameThunks,
+          "The number of lazified callsites whose thunks are not memoized.");
+STATISTIC(NumThunkEvaluationsMerged,
+          "The number of thunk evaluations replaced by a dominating evaluation "
+          "of the same thunk.");
+STATISTIC(NumThunksHoisted,
+          "The number of thunks initialized in a loop preheader rather than "
+          "in every iteration.");
+STATISTIC(NumStackBuffersMigrated,
+          "The number of local buffers built by delegate functions rather "
+          "than by the caller.");
+STATISTIC(NumLibCallsDeferred,
+          "The number of library calls that only write errno moved from the "
+          "caller into delegate functions.");
+STATISTIC(NumCandidatesSkipped,
+          "The number of lazification candidates skipped because the "
+          "compile-time or code-growth budget ran out.");
+STATISTIC(NumDelegatesFolded,
+          "The number of delegate functions folded into an equivalent one.");
+STATISTIC(NumClonesFolded,
+          "The number of callee clones folded into an equivalent one.");
+STATISTIC(NumInstsFolded,
+          "The number of instructions removed by folding equivalent delegate "
+          "functions and callee clones.");
+STATISTIC(NumThunkCallsDevirtualized,
+          "The number of thunk evaluations in callee clones that call their "
+          "delegate function directly.");
 
 using namespace llvm;
 
 static cl::opt<bool> WyvernLazyficationMemoization(
     "wylazy-memo", cl::init(true),
     cl::desc(
-        "Wyvern - Enable memoization in Lazyfication (implement call-by-need"
-        "rather than call-by-name)."));
+        "Wyvern - Enable memoization in Lazyfication (implement call-by-need "
+        "rather than call-by-name), for callsites whose thunks may be "
+        "evaluated more than once per call."));
 
 static cl::opt<bool> WyvernEnablePGO(
     "wylazy-pgo", cl::init(false),
@@ -58,6 +114,51 @@ static cl::opt<double> WyvernPGOThreshold(
     cl::desc("Wyvern - Argument evaluation percentage threshold below which "
              "callsite should be lazyfied."));
 
+static cl::opt<bool> WyvernForwardThunks(
+    "wylazy-forward-thunks", cl::init(false),
+    cl::desc("Wyvern - When a lazified callee passes its thunk on to another "
+             "call, pass the thunk itself to a lazified clone of the next "
+             "callee, instead of evaluating it at the call."));
+
+static cl::opt<bool> WyvernIndirectCallPromotion(
+    "wylazy-icp", cl::init(true),
+    cl::desc("Wyvern - Promote indirect calls to their most frequent target "
+             "(according to the profile), so that they can be lazified. Only "
+             "used with PGO."));
+
+static cl::opt<double> WyvernICPThreshold(
+    "wylazy-icp-threshold", cl::init(0.5),
+    cl::desc("Wyvern - Fraction of the calls of an indirect callsite that must "
+             "reach a single target for the callsite to be promoted."));
+
+static cl::opt<unsigned> WyvernRegisterEnvSize(
+    "wylazy-register-env-size", cl::init(2),
+    cl::desc("Wyvern - Maximum number of scalar values in the environment of a "
+             "thunk for it to be passed to the callee in registers, rather "
+             "than through memory (0 disables)."));
+
+static cl::opt<unsigned> WyvernRegisterEnvCalleeSize(
+    "wylazy-register-env-callee-size", cl::init(64),
+    cl::desc("Wyvern - Maximum number of instructions of a callee for it to "
+             "be cloned to receive the environment of a thunk in registers."));
+
+static cl::opt<unsigned> WyvernTimeBudget(
+    "wylazy-time-budget", cl::init(0),
+    cl::desc("Wyvern - Time, in milliseconds, after which no more callsites "
+             "are lazified (0 disables)."));
+
+static cl::opt<unsigned> WyvernGrowthBudget(
+    "wylazy-growth-budget", cl::init(0),
+    cl::desc("Wyvern - Maximum number of instructions that lazification may "
+             "add to the module, as a percentage of its original size (0 "
+             "disables)."));
+
+static cl::opt<bool> WyvernCodeSizeReport(
+    "wylazy-size-report", cl::init(false),
+    cl::desc("Wyvern - Print the number of instructions added to the module by "
+             "delegate functions and callee clones, and removed by folding "
+             "equivalent ones."));
+
 static cl::opt<bool> WyvernLazyfication(
     "wylazy-enable", cl::init(true),
     cl::desc("Wyvern - Controls whether to enable lazyfication at all (used "
@@ -105,6 +206,108 @@ static void removeAttributesFromThunkArgument(Value &V, unsigned int index) {
   }
 }
 
+/// Callee clones access memory that the original callee did not: they read
+/// their thunks and call delegate functions, which may read any memory and
+/// write the memoized value to the thunk. This function removes the attributes
+/// of function (or call) @param V that state otherwise.
+static void removeMemoryAttributes(Value &V) {
+  AttributeMask toRemove;
+
+  toRemove.addAttribute(Attribute::ReadNone);
+  toRemove.addAttribute(Attribute::ReadOnly);
+  toRemove.addAttribute(Attribute::WriteOnly);
+  toRemove.addAttribute(Attribute::ArgMemOnly);
+  toRemove.addAttribute(Attribute::InaccessibleMemOnly);
+  toRemove.addAttribute(Attribute::InaccessibleMemOrArgMemOnly);
+
+  if (CallInst *CI = dyn_cast<CallInst>(&V)) {
+    CI->removeFnAttrs(toRemove);
+  } else if (Function *F = dyn_cast<Function>(&V)) {
+    F->removeFnAttrs(toRemove);
+  }
+}
+
+/// Emits the evaluation of thunk @param thunk, of type @param thunkStructType,
+/// at the insertion point of @param builder. The delegate function pointer is
+/// loaded from the thunk, and then called with the thunk itself.
+static CallInst *createThunkCall(IRBuilder<> &builder, Value *thunk,
+                                 StructType *thunkStructType) {
+  FunctionType *delegateFunctionType =
+      ProgramSlice::getDelegateFunctionType(thunkStructType);
+  Value *thunkPtr =
+      builder.CreatePointerCast(thunk, thunkStructType->getPointerTo());
+  Value *thunkFPtrGEP = builder.CreateStructGEP(thunkStructType, thunkPtr, 0,
+                                                "_wyvern_thunk_fptr_addr");
+  Value *thunkFPtrLoad = builder.CreateLoad(
+      thunkStructType->getElementType(0), thunkFPtrGEP, "_wyvern_thunkfptr");
+  Value *thunkArg = builder.CreatePointerCast(
+      thunk, delegateFunctionType->getParamType(0));
+  return builder.CreateCall(delegateFunctionType, thunkFPtrLoad, {thunkArg},
+                            "_wyvern_thunkcall");
+}
+
+/// Emits the evaluation of thunk @param thunk at the insertion point of
+/// @param builder, accessing it through header @param thunkStructType. If the
+/// header holds the memoization state, the memoized value is loaded inline, and
+/// the delegate function is only called on a cold path, the first time the
+/// thunk is evaluated. Evaluated thunks point to the function of
+/// @param memoFunctions that returns their value.
+static Value *createThunkEvaluation(IRBuilder<> &builder, Value *thunk,
+                                    StructType *thunkStructType,
+                                    MemoizedValueFunctionMap &memoFunctions) {
+  Type *valueType =
+      ProgramSlice::getDelegateFunctionType(thunkStructType)->getReturnType();
+  if (thunkStructType != ProgramSlice::getThunkHeaderType(valueType, true)) {
+    return createThunkCall(builder, thunk, thunkStructType);
+  }
+
+  // Evaluated thunks point to the function that returns their memoized value
+  Instruction *insertPoint = &*builder.GetInsertPoint();
+  Module &M = *insertPoint->getModule();
+  FunctionType *delegateFunctionType =
+      ProgramSlice::getDelegateFunctionType(thunkStructType);
+  Value *thunkPtr =
+      builder.CreatePointerCast(thunk, thunkStructType->getPointerTo());
+  Value *thunkFPtrGEP = builder.CreateStructGEP(thunkStructType, thunkPtr, 0,
+                                                "_wyvern_thunk_fptr_addr");
+  Value *thunkFPtrLoad = builder.CreateLoad(
+      thunkStructType->getElementType(0), thunkFPtrGEP, "_wyvern_thunkfptr");
+  Value *memoFlag = builder.CreateICmpEQ(
+      thunkFPtrLoad,
+      ProgramSlice::getMemoizedValueFunction(valueType, M, memoFunctions),
+      "_wyvern_memo_flag");
+
+  Instruction *hitTerm, *missTerm;
+  MDBuilder MDB(builder.getContext());
+  SplitBlockAndInsertIfThenElse(memoFlag, insertPoint, &hitTerm, &missTerm,
+                                MDB.createBranchWeights(2000, 1));
+  hitTerm->getParent()->setName("_wyvern_memo_hit");
+  missTerm->getParent()->setName("_wyvern_memo_miss");
+  insertPoint->getParent()->setName("_wyvern_memo_join");
+
+  builder.SetInsertPoint(hitTerm);
+  Value *memoValGEP = builder.CreateStructGEP(thunkStructType, thunkPtr, 1,
+                                              "_wyvern_memo_val_addr");
+  Value *memoVal =
+      builder.CreateLoad(valueType, memoValGEP, "_wyvern_memo_val");
+
+  builder.SetInsertPoint(missTerm);
+  CallInst *thunkCall = builder.CreateCall(
+      delegateFunctionType, thunkFPtrLoad,
+      {builder.CreatePointerCast(thunk, delegateFunctionType->getParamType(0))},
+      "_wyvern_thunkcall");
+  thunkCall->addFnAttr(Attribute::NoInline);
+  thunkCall->addFnAttr(Attribute::Cold);
+
+  builder.SetInsertPoint(insertPoint->getParent(),
+                         insertPoint->getParent()->begin());
+  PHINode *thunkValue = builder.CreatePHI(valueType, 2, "_wyvern_thunkval");
+  thunkValue->addIncoming(memoVal, hitTerm->getParent());
+  thunkValue->addIncoming(thunkCall, missTerm->getParent());
+  builder.SetInsertPoint(insertPoint);
+  return thunkValue;
+}
+
 /// At this point, Function @param F was subject to transformations to lazify
 /// a function call, as either the caller or the callee.
 ///
@@ -117,20 +320,37 @@ static void removeAttributesFromThunkArgument(Value &V, unsigned int index) {
 /// In regards to the callee, it was lazyfied and one of its arguments is now
 /// @param thunkValue. However, uses of the argument within the function still
 /// use it as a value rather than a thunk, so we replace these uses by proper
-/// loading/invocation of the thunk.
-static void updateThunkArgUses(Function *F, Value *thunkValue,
-                               StructType *thunkStructType,
-                               Function *slicedFunction,
-                               Value *valueToReplace = nullptr) {
+/// loading/invocation of the thunk. Uses in @param forwardedUses, through
+/// which the thunk is forwarded to other callee clones, are left as they are.
+static void
+updateThunkArgUses(Function *F, Value *thunkValue, StructType *thunkStructType,
+                   MemoizedValueFunctionMap &memoFunctions,
+                   Function *slicedFunction = nullptr,
+                   Value *valueToReplace = nullptr,
+                   const SmallPtrSetImpl<Use *> *forwardedUses = nullptr) {
   // We could be adding thunk uses in either the caller or callee
   bool isCallee = (valueToReplace == nullptr);
-  std::map<Use *, CallInst *> useCalls;
+  std::map<Use *, Value *> useCalls;
 
   IRBuilder<> builder(F->getContext());
 
+  // Evaluating the thunk adds uses of it, and may split blocks, so the uses to
+  // be replaced are collected beforehand
   Value *toReplace = isCallee ? thunkValue : valueToReplace;
+  SmallVector<Use *> uses;
   for (auto &Use : toReplace->uses()) {
+    uses.push_back(&Use);
+  }
+
+  for (auto *UsePtr : uses) {
+    auto &Use = *UsePtr;
     Instruction *UserI = dyn_cast<Instruction>(Use.getUser());
+
+    // Thunks forwarded to other callee clones are passed as they are
+    if (forwardedUses && forwardedUses->count(UsePtr)) {
+      continue;
+    }
+
     if (UserI) {
       // If the use is a PHINode, the use happens at the edge, so we cannot
       // insert the thunk load/call at the PHI's block. Instead, we must insert
@@ -143,17 +363,6 @@ static void updateThunkArgUses(Function *F, Value *thunkValue,
         builder.SetInsertPoint(UserI);
       }
 
-      Value *thunkCallTarget = slicedFunction;
-      // When optimizing the callee, load the function pointer from the thunk
-      if (isCallee) {
-        Value *thunkFPtrGEP = builder.CreateStructGEP(
-            thunkStructType, thunkValue, 0, "_wyvern_thunk_fptr_addr");
-        Value *thunkFPtrLoad =
-            builder.CreateLoad(thunkStructType->getStructElementType(0),
-                               thunkFPtrGEP, "_wyvern_thunkfptr");
-        thunkCallTarget = thunkFPtrLoad;
-      }
-
       // For both caller and callee, add call to delegate function (either
       // loaded from the thunk or directly from the value used to initialize it)
       if (WyvernThunkDebugging) {
@@ -167,9 +376,12 @@ static void updateThunkArgUses(Function *F, Value *thunkValue,
         generatePrintf(dbg_fmt, debug_args, builder);
       }
 
-      CallInst *thunkCall =
-          builder.CreateCall(slicedFunction->getFunctionType(), thunkCallTarget,
-                             {thunkValue}, "_wyvern_thunkcall");
+      // When optimizing the callee, load the function pointer from the thunk
+      Value *thunkCall =
+          isCallee ? createThunkEvaluation(builder, thunkValue,
+                                           thunkStructType, memoFunctions)
+                   : builder.CreateCall(slicedFunction, {thunkValue},
+                                        "_wyvern_thunkcall");
 
       // Replacing uses/users immediately can break use-def chains. Instead,
       // keep track of all uses to be updated.
@@ -180,37 +392,52 @@ static void updateThunkArgUses(Function *F, Value *thunkValue,
   // Update uses
   for (auto &entry : useCalls) {
     Use *use = entry.first;
-    CallInst *CI = entry.second;
-    use->set(CI);
+    use->set(entry.second);
   }
 }
 
+/// Returns the name of @param F without the numeric suffix that is added to
+/// functions created with the same name as another, which does not identify
+/// their contents.
+static std::string getBaseName(const Function &F) {
+  auto [prefix, suffix] = F.getName().rsplit('.');
+  if (!suffix.empty() && all_of(suffix, isDigit)) {
+    return prefix.str();
+  }
+  return F.getName().str();
+}
+
+/// Makes clone @param F local to the module. Cloning copies the visibility and
+/// dso_local flag of the original function, which an internal function must
+/// not keep.
+static void resetCloneLinkage(Function &F) {
+  F.setVisibility(GlobalValue::DefaultVisibility);
+  F.setLinkage(GlobalValue::InternalLinkage);
+}
+
 /// Clones function @param Callee, replacing its formal parameter of index
-/// @param index with thunk @param thunkArg.
+/// @param index with a thunk of type @param thunkArgType. Uses of the thunk in
+/// the clone must still be updated with updateThunkArgUses.
 static Function *cloneCalleeFunction(Function &Callee, int index,
-                                     Function &slicedFunction, Value *thunkArg,
-                                     StructType *thunkStructType, Module &M) {
+                                     Type *thunkArgType, Module &M) {
   SmallVector<Type *> argTypes;
   for (auto &arg : Callee.args()) {
     argTypes.push_back(arg.getType());
   }
-  argTypes[index] = thunkArg->getType();
-
-  // generate a random number to use as suffix for clone, to avoid naming
-  // conflicts
-  // NOTE: we cannot use a simple counter that gets incremented on every
-  // clone here, because when optimizing per translation unit, the same callee
-  // may be cloned across different translation units
-  std::random_device rd;
-  std::mt19937 mt(rd());
-  std::uniform_int_distribution<int64_t> dist(1, 1000000000);
-  uint64_t random_num = dist(mt);
-  FunctionType *FT = FunctionType::get(Callee.getReturnType(), argTypes, false);
-  std::string functionName = "_wyvern_calleeclone_" + Callee.getName().str() +
-                             "_" + std::to_string(index) +
-                             std::to_string(random_num);
+  argTypes[index] = thunkArgType;
+
+  // The name is made unique when the pass finishes, by nameGeneratedFunctions
+  FunctionType *FT =
+      FunctionType::get(Callee.getReturnType(), argTypes, Callee.isVarArg());
+  // Clones of clones (call sites lazified in several arguments) only append
+  // the new index to the name
+  std::string prefix = Callee.getName().startswith("_wyvern_calleeclone_")
+                           ? ""
+                           : "_wyvern_calleeclone_";
+  std::string functionName =
+      prefix + getBaseName(Callee) + "_" + std::to_string(index);
   Function *newCallee =
-      Function::Create(FT, Function::ExternalLinkage, functionName, M);
+      Function::Create(FT, Function::InternalLinkage, functionName, M);
 
   ValueToValueMapTy vMap;
   int idx = -1;
@@ -227,15 +454,350 @@ static Function *cloneCalleeFunction(Function &Callee, int index,
   SmallVector<ReturnInst *, 4> Returns;
   CloneFunctionInto(newCallee, &Callee, vMap,
                     CloneFunctionChangeType::LocalChangesOnly, Returns);
+  resetCloneLinkage(*newCallee);
+  removeMemoryAttributes(*newCallee);
+
+  return newCallee;
+}
+
+/// Returns whether every instruction that may execute before the variadic
+/// arguments of @param F are accessed (through va_start) is free of side
+/// effects. In that case, a clone of @param F may run that code and then hand
+/// over to the original function, which runs it again, once the variadic
+/// arguments are actually needed.
+static bool isVarArgPrefixSafe(Function &F) {
+  std::set<BasicBlock *> vaStartBlocks;
+  for (inst_iterator I = inst_begin(F); I != inst_end(F); ++I) {
+    if (isa<VAStartInst>(&*I)) {
+      vaStartBlocks.insert(I->getParent());
+    }
+  }
+
+  // collect every block from which some va_start is reachable
+  std::set<BasicBlock *> prefixBlocks;
+  std::stack<BasicBlock *> worklist;
+  for (BasicBlock *BB : vaStartBlocks) {
+    worklist.push(BB);
+  }
+  while (!worklist.empty()) {
+    BasicBlock *cur = worklist.top();
+    worklist.pop();
+    for (BasicBlock *pred : predecessors(cur)) {
+      if (prefixBlocks.insert(pred).second) {
+        worklist.push(pred);
+      }
+    }
+  }
+
+  auto isSafe = [](Instruction &I) {
+    if (isa<DbgInfoIntrinsic>(&I) || I.isLifetimeStartOrEnd()) {
+      return true;
+    }
+    return !I.mayWriteToMemory() && !I.isVolatile();
+  };
+
+  for (BasicBlock *BB : prefixBlocks) {
+    for (Instruction &I : *BB) {
+      if (!isSafe(I)) {
+        return false;
+      }
+    }
+  }
+
+  for (BasicBlock *BB : vaStartBlocks) {
+    if (prefixBlocks.count(BB)) {
+      continue;
+    }
+    for (Instruction &I : *BB) {
+      if (isa<VAStartInst>(&I)) {
+        break;
+      }
+      if (!isSafe(I)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/// Clones variadic function @param Callee for call site @param CI, in which the
+/// actual parameter of index @param index is one of the variadic arguments and
+/// is replaced with thunk @param thunkArg. The clone is not variadic: it takes
+/// every actual parameter of @param CI as a formal parameter. Blocks of the
+/// clone that would call va_start instead evaluate the thunk and call the
+/// original @param Callee with the original arguments, so the thunk is only
+/// evaluated on paths that access the variadic arguments. Requires
+/// isVarArgPrefixSafe(@param Callee).
+static Function *
+cloneVarArgCalleeFunction(Function &Callee, CallInst &CI, int index,
+                          Type *thunkArgType, StructType *thunkStructType,
+                          MemoizedValueFunctionMap &memoFunctions, Module &M) {
+  SmallVector<Type *> argTypes;
+  for (auto &arg : CI.args()) {
+    argTypes.push_back(arg->getType());
+  }
+  argTypes[index] = thunkArgType;
+
+  FunctionType *FT = FunctionType::get(Callee.getReturnType(), argTypes, false);
+  std::string functionName = "_wyvern_calleeclone_" + Callee.getName().str() +
+                             "_" + std::to_string(index);
+  Function *newCallee =
+      Function::Create(FT, Function::InternalLinkage, functionName, M);
+
+  ValueToValueMapTy vMap;
+  for (auto &arg : Callee.args()) {
+    vMap[&arg] = newCallee->getArg(arg.getArgNo());
+    newCallee->getArg(arg.getArgNo())->setName(arg.getName());
+  }
+  newCallee->getArg(index)->setName("_wyvern_thunkptr");
+
+  SmallVector<ReturnInst *, 4> Returns;
+  CloneFunctionInto(newCallee, &Callee, vMap,
+                    CloneFunctionChangeType::LocalChangesOnly, Returns);
+  resetCloneLinkage(*newCallee);
+  removeMemoryAttributes(*newCallee);
+
+  std::set<BasicBlock *> vaStartBlocks;
+  for (inst_iterator I = inst_begin(newCallee); I != inst_end(newCallee);
+       ++I) {
+    if (isa<VAStartInst>(&*I)) {
+      vaStartBlocks.insert(I->getParent());
+    }
+  }
+
+  // Replace each block that calls va_start by a call to the original callee.
+  // The thunk is passed as is for now, and is turned into a proper thunk
+  // evaluation along with every other use of the thunk argument below.
+  SmallVector<Value *> forwardedArgs;
+  for (auto &arg : newCallee->args()) {
+    forwardedArgs.push_back(&arg);
+  }
+  for (BasicBlock *BB : vaStartBlocks) {
+    for (BasicBlock *succ : successors(BB)) {
+      succ->removePredecessor(BB);
+    }
+    while (!BB->empty()) {
+      Instruction &I = BB->back();
+      I.replaceAllUsesWith(UndefValue::get(I.getType()));
+      I.eraseFromParent();
+    }
+
+    IRBuilder<> builder(BB);
+    CallInst *forwardCall =
+        builder.CreateCall(Callee.getFunctionType(), &Callee, forwardedArgs);
+    forwardCall->setCallingConv(Callee.getCallingConv());
+    if (Callee.getReturnType()->isVoidTy()) {
+      builder.CreateRetVoid();
+    } else {
+      builder.CreateRet(forwardCall);
+    }
+  }
+  removeUnreachableBlocks(*newCallee);
+
+  updateThunkArgUses(newCallee, newCallee->getArg(index), thunkStructType,
+                     memoFunctions);
+  verifyFunction(*newCallee);
+
+  return newCallee;
+}
+
+/// Returns the name of the lazy entry point of function @param F, in terms of
+/// its parameter of index @param index. The name must be the same across
+/// translation units, so that callers can find the entry point at link time.
+static std::string getLazyEntryName(Function &F, unsigned index) {
+  return "_wyvern_lazyentry_" + F.getName().str() + "_" + std::to_string(index);
+}
+
+/// Creates the lazy entry point of function @param F, which has parameter of
+/// index @param index annotated as lazy: a clone of @param F that receives that
+/// parameter as a thunk of unknown layout. Callers in other translation units,
+/// that only see the declaration of @param F, call it through
+/// getOrCreateLazyWrapper.
+static Function *createLazyEntryPoint(Function &F, unsigned index,
+                                      MemoizedValueFunctionMap &memoFunctions,
+                                      Module &M) {
+  Type *thunkArgType = Type::getInt8PtrTy(M.getContext());
+  StructType *thunkStructType =
+      ProgramSlice::getThunkHeaderType(F.getArg(index)->getType());
+
+  Function *entryPoint = cloneCalleeFunction(F, index, thunkArgType, M);
+  updateThunkArgUses(entryPoint, entryPoint->getArg(index), thunkStructType,
+                     memoFunctions);
+  verifyFunction(*entryPoint);
+  entryPoint->setName(getLazyEntryName(F, index));
+  entryPoint->setLinkage(GlobalValue::ExternalLinkage);
+  entryPoint->setVisibility(F.getVisibility());
+  entryPoint->setDSOLocal(F.isDSOLocal());
+  removeAttributesFromThunkArgument(*entryPoint, index);
+  return entryPoint;
+}
+
+/// Returns a wrapper for function @param Callee, which has no body in this
+/// module, that receives its parameter of index @param index as a thunk. If
+/// the lazy entry point of @param Callee is linked in, the wrapper forwards the
+/// thunk to it. Otherwise, the lazy entry point resolves to null (it is
+/// declared as a weak symbol), and the wrapper evaluates the thunk and calls
+/// @param Callee.
+static Function *createLazyWrapper(Function &Callee, unsigned index,
+                                   Module &M) {
+  LLVMContext &Ctx = M.getContext();
+  Type *thunkArgType = Type::getInt8PtrTy(Ctx);
+  StructType *thunkStructType =
+      ProgramSlice::getThunkHeaderType(Callee.getArg(index)->getType());
+
+  SmallVector<Type *> argTypes;
+  for (auto &arg : Callee.args()) {
+    argTypes.push_back(arg.getType());
+  }
+  argTypes[index] = thunkArgType;
+  FunctionType *FT = FunctionType::get(Callee.getReturnType(), argTypes, false);
+
+  std::string entryName = getLazyEntryName(Callee, index);
+  Function *entryPoint = M.getFunction(entryName);
+  if (!entryPoint) {
+    entryPoint =
+        Function::Create(FT, Function::ExternalWeakLinkage, entryName, M);
+  }
+
+  Function *wrapper =
+      Function::Create(FT, Function::InternalLinkage,
+                       "_wyvern_lazywrapper_" + Callee.getName().str() + "_" +
+                           std::to_string(index),
+                       M);
+  SmallVector<Value *> args;
+  for (auto &arg : wrapper->args()) {
+    arg.setName(arg.getArgNo() == index
+                    ? "_wyvern_thunkptr"
+                    : Callee.getArg(arg.getArgNo())->getName());
+    args.push_back(&arg);
+  }
+
+  BasicBlock *entry =
+      BasicBlock::Create(Ctx, "_wyvern_lazywrapper_entry", wrapper);
+  BasicBlock *lazyBB =
+      BasicBlock::Create(Ctx, "_wyvern_lazywrapper_lazy", wrapper);
+  BasicBlock *eagerBB =
+      BasicBlock::Create(Ctx, "_wyvern_lazywrapper_eager", wrapper);
+
+  IRBuilder<> builder(entry);
+  Value *hasEntryPoint = builder.CreateIsNotNull(
+      builder.CreateBitCast(entryPoint, builder.getInt8PtrTy()),
+      "_wyvern_has_lazyentry");
+  builder.CreateCondBr(hasEntryPoint, lazyBB, eagerBB);
+
+  builder.SetInsertPoint(lazyBB);
+  CallInst *lazyCall = builder.CreateCall(FT, entryPoint, args);
+  if (Callee.getReturnType()->isVoidTy()) {
+    builder.CreateRetVoid();
+  } else {
+    builder.CreateRet(lazyCall);
+  }
+
+  builder.SetInsertPoint(eagerBB);
+  args[index] =
+      createThunkCall(builder, wrapper->getArg(index), thunkStructType);
+  CallInst *eagerCall = builder.CreateCall(&Callee, args);
+  eagerCall->setCallingConv(Callee.getCallingConv());
+  if (Callee.getReturnType()->isVoidTy()) {
+    builder.CreateRetVoid();
+  } else {
+    builder.CreateRet(eagerCall);
+  }
+
+  verifyFunction(*wrapper);
+  return wrapper;
+}
+
+Function *WyvernLazyficationPass::getOrCloneCallee(Function &Callee,
+                                                   unsigned index,
+                                                   Type *thunkArgType,
+                                                   StructType *thunkStructType,
+                                                   Module &M) {
+  auto tuple =
+      std::make_tuple(&Callee, index, thunkStructType, (FunctionType *)nullptr);
+  if (Function *previouslyClonedCallee = clonedCallees[tuple]) {
+    return previouslyClonedCallee;
+  }
+
+  Function *newCallee = cloneCalleeFunction(Callee, index, thunkArgType, M);
+  removeAttributesFromThunkArgument(*newCallee, index);
+  cloneOrigins[newCallee] = getOriginalCallee(&Callee);
+  cloneThunkArgs[newCallee] = cloneThunkArgs[&Callee];
+  cloneThunkArgs[newCallee].push_back(index);
+
+  // The clone must be cached before forwarding its thunk, since the callees
+  // it is forwarded to may be (mutually) recursive
+  clonedCallees[tuple] = newCallee;
+  SmallPtrSet<Use *, 4> forwardedUses;
+  if (WyvernForwardThunks) {
+    forwardThunkArg(newCallee, newCallee->getArg(index), thunkStructType,
+                    forwardedUses, M);
+  }
+
   updateThunkArgUses(newCallee, newCallee->getArg(index), thunkStructType,
-                     &slicedFunction);
+                     memoFunctions, nullptr, nullptr, &forwardedUses);
   verifyFunction(*newCallee);
 
   return newCallee;
 }
 
+bool WyvernLazyficationPass::isForwardableUse(Use &U, unsigned &argNo) {
+  FindLazyfiableAnalysis &FLA = getAnalysis<FindLazyfiableAnalysis>();
+
+  CallInst *CI = dyn_cast<CallInst>(U.getUser());
+  if (!CI || !CI->isArgOperand(&U) || count(CI->args(), U.get()) != 1) {
+    return false;
+  }
+
+  // The next callee must be a candidate for lazification in terms of the
+  // parameter that receives the thunk
+  Function *nextCallee = CI->getCalledFunction();
+  argNo = CI->getArgOperandNo(&U);
+  return nextCallee && !nextCallee->isDeclaration() &&
+         argNo < nextCallee->arg_size() &&
+         nextCallee->getArg(argNo)->getNumUses() != 0 &&
+         !FLA.isAnnotatedEager(nextCallee, argNo) &&
+         FLA.isPromisingFunctionArg(nextCallee, argNo);
+}
+
+void WyvernLazyficationPass::forwardThunkArg(
+    Function *F, Argument *thunkArg, StructType *thunkStructType,
+    SmallPtrSetImpl<Use *> &forwardedUses, Module &M) {
+  SmallVector<std::pair<Use *, unsigned>> forwardableCalls;
+  for (Use &U : thunkArg->uses()) {
+    unsigned argNo;
+    if (isForwardableUse(U, argNo)) {
+      forwardableCalls.push_back(std::make_pair(&U, argNo));
+    }
+  }
+
+  for (auto &[U, argNo] : forwardableCalls) {
+    CallInst *CI = cast<CallInst>(U->getUser());
+    LLVM_DEBUG(dbgs() << "Forwarding thunk " << thunkArg->getName() << " in "
+                      << F->getName() << " to " << *CI << "\n");
+    Function *nextCallee =
+        getOrCloneCallee(*CI->getCalledFunction(), argNo, thunkArg->getType(),
+                         thunkStructType, M);
+    CI->setCalledFunction(nextCallee);
+    removeAttributesFromThunkArgument(*CI, argNo);
+    removeMemoryAttributes(*CI);
+    forwardedUses.insert(U);
+    ++NumThunksForwarded;
+  }
+}
+
 bool WyvernLazyficationPass::shouldLazifyCallsitePGO(CallInst *CI,
                                                      uint8_t argIdx) {
+  FindLazyfiableAnalysis &FLA = getAnalysis<FindLazyfiableAnalysis>();
+  Function *callee = getOriginalCallee(CI->getCalledFunction());
+  if (callee && FLA.isAnnotatedEager(callee, argIdx)) {
+    return false;
+  }
+  if (callee && FLA.isAnnotatedAlwaysLazy(callee, argIdx)) {
+    return true;
+  }
+
   WyvernCallSiteProfInfo *prof_info = profileInfo[CI].get();
 
   if (!prof_info) {
@@ -294,8 +856,19 @@ bool WyvernLazyficationPass::loadProfileInfo(Module &M, std::string path) {
       getline(profileReportFile, parsed_val, ',');
       newEntry->_totalEvals[i] = stol(parsed_val);
     }
-    profileReportFile.ignore(std::numeric_limits<std::streamsize>::max(),
-                             profileReportFile.widen('\n'));
+
+    // indirect callsites end with a list of "target:count" entries
+    std::string targets;
+    getline(profileReportFile, targets);
+    std::stringstream targetsStream(targets);
+    while (getline(targetsStream, parsed_val, ',')) {
+      size_t sep = parsed_val.rfind(':');
+      if (sep == std::string::npos) {
+        continue;
+      }
+      newEntry->_targets.emplace_back(parsed_val.substr(0, sep),
+                                      stol(parsed_val.substr(sep + 1)));
+    }
 
     if (M.getFunction(callerName) == nullptr) {
       continue;
@@ -320,11 +893,666 @@ bool WyvernLazyficationPass::loadProfileInfo(Module &M, std::string path) {
   return true;
 }
 
+bool WyvernLazyficationPass::promoteIndirectCalls(Module &M) {
+  SmallVector<CallInst *> indirectCalls;
+  for (Function &F : M) {
+    for (inst_iterator I = inst_begin(F); I != inst_end(F); ++I) {
+      CallInst *CI = dyn_cast<CallInst>(&*I);
+      if (CI && CI->isIndirectCall() && profileInfo.count(CI) &&
+          !profileInfo[CI]->_targets.empty()) {
+        indirectCalls.push_back(CI);
+      }
+    }
+  }
+
+  bool changed = false;
+  for (CallInst *CI : indirectCalls) {
+    WyvernCallSiteProfInfo *prof_info = profileInfo[CI].get();
+
+    auto hottest = std::max_element(
+        prof_info->_targets.begin(), prof_info->_targets.end(),
+        [](auto &a, auto &b) { return a.second < b.second; });
+    uint64_t numCalls = prof_info->_numCalls;
+    uint64_t targetCalls = hottest->second;
+    if ((double)targetCalls / (double)numCalls < WyvernICPThreshold) {
+      continue;
+    }
+
+    Function *target = M.getFunction(hottest->first);
+    if (!target || target->isDeclaration()) {
+      LLVM_DEBUG(dbgs() << "Cannot promote indirect call " << *CI
+                        << ". Target " << hottest->first
+                        << " is not defined in this module!\n");
+      continue;
+    }
+
+    const char *reason = nullptr;
+    if (!isLegalToPromote(*CI, target, &reason)) {
+      LLVM_DEBUG(dbgs() << "Cannot promote indirect call " << *CI << " to "
+                        << target->getName() << ": " << reason << "\n");
+      continue;
+    }
+
+    LLVM_DEBUG(dbgs() << "Promoting indirect call " << *CI << " to "
+                      << target->getName() << "\n");
+
+    MDBuilder MDB(M.getContext());
+    MDNode *weights = MDB.createBranchWeights(
+        targetCalls, numCalls > targetCalls ? numCalls - targetCalls : 0);
+    CallBase &directCall = promoteCallWithIfThenElse(*CI, target, weights);
+
+    // The argument evaluation counters are not split per target, so the
+    // promoted call inherits the evaluation rates of the original callsite.
+    profileInfo[&directCall] =
+        std::make_unique<WyvernCallSiteProfInfo>(*prof_info);
+    profileInfo[&directCall]->_targets.clear();
+
+    ++NumIndirectCallsPromoted;
+    changed = true;
+  }
+
+  return changed;
+}
+
+/// Returns whether @param CI evaluates thunk @param thunk, i.e., calls the
+/// delegate function pointer loaded from the thunk's first field.
+static bool isThunkCall(CallInst *CI, Value *thunk) {
+  LoadInst *fptrLoad = dyn_cast<LoadInst>(CI->getCalledOperand());
+  if (!CI->isIndirectCall() || !fptrLoad) {
+    return false;
+  }
+  GEPOperator *fptrGEP = dyn_cast<GEPOperator>(fptrLoad->getPointerOperand());
+  return fptrGEP && fptrGEP->hasAllZeroIndices() &&
+         fptrGEP->getPointerOperand()->stripPointerCasts() == thunk;
+}
+
+bool WyvernLazyficationPass::devirtualizeThunkCalls(Module &M) {
+  // Computes the set of delegates of the thunks that may reach each thunk
+  // parameter of a clone. Thunks forwarded from other clones propagate their
+  // delegates, so sets are computed up to a fixed point. Parameters reached by
+  // thunks of unknown origin are left untouched.
+  typedef std::pair<Function *, unsigned> ThunkParam;
+  std::map<ThunkParam, std::set<Function *>> delegates;
+  std::set<ThunkParam> unknown;
+  bool updated = true;
+  while (updated) {
+    updated = false;
+    for (auto &[F, indices] : cloneThunkArgs) {
+      for (unsigned index : indices) {
+        ThunkParam param = std::make_pair(F, index);
+        if (unknown.count(param)) {
+          continue;
+        }
+
+        for (User *U : F->users()) {
+          CallBase *CB = dyn_cast<CallBase>(U);
+          if (!CB || CB->getCalledOperand() != F) {
+            unknown.insert(param);
+            break;
+          }
+
+          Value *thunk = CB->getArgOperand(index)->stripPointerCasts();
+          Argument *forwarded = dyn_cast<Argument>(thunk);
+          if (thunkDelegates.count(thunk)) {
+            updated |= delegates[param].insert(thunkDelegates[thunk]).second;
+          } else if (forwarded &&
+                     cloneThunkArgs.count(forwarded->getParent()) &&
+                     is_contained(cloneThunkArgs[forwarded->getParent()],
+                                  forwarded->getArgNo())) {
+            ThunkParam source =
+                std::make_pair(forwarded->getParent(), forwarded->getArgNo());
+            if (unknown.count(source)) {
+              unknown.insert(param);
+              break;
+            }
+            for (Function *delegate : delegates[source]) {
+              updated |= delegates[param].insert(delegate).second;
+            }
+          } else {
+            unknown.insert(param);
+            break;
+          }
+        }
+
+        if (unknown.count(param)) {
+          updated = true;
+        }
+      }
+    }
+  }
+
+  bool changed = false;
+  for (auto &[param, paramDelegates] : delegates) {
+    if (unknown.count(param) || paramDelegates.empty()) {
+      continue;
+    }
+
+    // Clones shared by several delegates only call the hottest one directly,
+    // weighted by the number of calls of the call sites they were created for
+    Function *target = *paramDelegates.begin();
+    uint64_t targetCalls = 0, totalCalls = 0;
+    if (paramDelegates.size() > 1) {
+      if (!WyvernEnablePGO) {
+        continue;
+      }
+      for (Function *delegate : paramDelegates) {
+        WyvernCallSiteProfInfo *prof_info =
+            profileInfo[delegateCallSites[delegate]].get();
+        uint64_t numCalls = prof_info ? prof_info->_numCalls : 0;
+        totalCalls += numCalls;
+        if (numCalls > targetCalls) {
+          target = delegate;
+          targetCalls = numCalls;
+        }
+      }
+      if (totalCalls == 0 ||
+          (double)targetCalls / (double)totalCalls < WyvernICPThreshold) {
+        continue;
+      }
+    }
+
+    Function *F = param.first;
+    Argument *thunkArg = F->getArg(param.second);
+    SmallVector<CallInst *> thunkCalls;
+    for (Instruction &I : instructions(F)) {
+      CallInst *CI = dyn_cast<CallInst>(&I);
+      if (CI && isThunkCall(CI, thunkArg) && isLegalToPromote(*CI, target)) {
+        thunkCalls.push_back(CI);
+      }
+    }
+
+    for (CallInst *CI : thunkCalls) {
+      LLVM_DEBUG(dbgs() << "Devirtualizing thunk call " << *CI << " in "
+                        << F->getName() << " to " << target->getName()
+                        << "\n");
+      Value *fptr = CI->getCalledOperand();
+      if (paramDelegates.size() == 1) {
+        promoteCall(*CI, target);
+      } else {
+        MDBuilder MDB(M.getContext());
+        promoteCallWithIfThenElse(
+            *CI, target,
+            MDB.createBranchWeights(targetCalls, totalCalls - targetCalls));
+      }
+      RecursivelyDeleteTriviallyDeadInstructions(fptr);
+      ++NumThunkCallsDevirtualized;
+      changed = true;
+    }
+  }
+
+  // Clones that receive the environment of a thunk in registers call the
+  // delegate packed with it, which is known if every call site packs the same
+  for (auto &[F, origin] : cloneOrigins) {
+    for (Argument &envArg : F->args()) {
+      if (!envArg.getType()->isStructTy() ||
+          !envArg.getName().startswith("_wyvern_env")) {
+        continue;
+      }
+
+      Function *target = nullptr;
+      bool unique = !F->use_empty();
+      for (User *U : F->users()) {
+        CallBase *CB = dyn_cast<CallBase>(U);
+        Value *packed =
+            CB && CB->getCalledOperand() == F
+                ? FindInsertedValue(CB->getArgOperand(envArg.getArgNo()), {0})
+                : nullptr;
+        Function *delegate =
+            packed ? dyn_cast<Function>(packed->stripPointerCasts()) : nullptr;
+        if (!delegate || (target && delegate != target)) {
+          unique = false;
+          break;
+        }
+        target = delegate;
+      }
+      if (!unique) {
+        continue;
+      }
+
+      for (User *U : make_early_inc_range(envArg.users())) {
+        ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(U);
+        if (!EVI || EVI->getIndices() != ArrayRef<unsigned>(0)) {
+          continue;
+        }
+        LLVM_DEBUG(dbgs() << "Devirtualizing environment delegate in "
+                          << F->getName() << " to " << target->getName()
+                          << "\n");
+        NumThunkCallsDevirtualized += EVI->getNumUses();
+        EVI->replaceAllUsesWith(
+            ConstantExpr::getPointerCast(target, EVI->getType()));
+        EVI->eraseFromParent();
+        changed = true;
+      }
+    }
+  }
+
+  return changed;
+}
+
+/// Returns whether @param F is a delegate, callee clone or memoized value
+/// function, which are named by nameGeneratedFunctions.
+static bool isGeneratedFunction(const Function &F) {
+  StringRef name = F.getName();
+  return name.startswith("_wyvern_slice_") ||
+         name.startswith("_wyvern_calleeclone_") ||
+         name.startswith("_wyvern_memo_ret_");
+}
+
+/// Adds the global values referenced by @param C, directly or through
+/// constant expressions, to @param globals.
+static void collectReferencedGlobals(const Constant *C,
+                                     SmallPtrSetImpl<const Constant *> &visited,
+                                     SetVector<const GlobalValue *> &globals) {
+  if (!visited.insert(C).second) {
+    return;
+  }
+  if (const GlobalValue *GV = dyn_cast<GlobalValue>(C)) {
+    globals.insert(GV);
+    return;
+  }
+  for (const Use &U : C->operands()) {
+    collectReferencedGlobals(cast<Constant>(U), visited, globals);
+  }
+}
+
+/// Adds the identified struct types that @param T refers to, directly or
+/// through other types, to @param structs.
+static void collectStructTypes(Type *T, SetVector<StructType *> &structs) {
+  StructType *ST = dyn_cast<StructType>(T);
+  if (ST && ST->hasName() && !structs.insert(ST)) {
+    return;
+  }
+  for (Type *subtype : T->subtypes()) {
+    collectStructTypes(subtype, structs);
+  }
+}
+
+/// Returns a hash of the contents of @param F: its code, attributes and the
+/// layout of the named types it uses, which are printed by name in the code.
+/// Functions with the same hash behave the same, as long as the globals they
+/// reference by name are the same.
+static std::string getContentHash(Function &F) {
+  std::string text;
+  raw_string_ostream rso(text);
+
+  // The name of the function itself does not take part in the hash
+  std::string name = F.getName().str();
+  F.setName("_wyvern_hashed_function");
+  F.print(rso);
+  F.setName(name);
+
+  SetVector<StructType *> structs;
+  collectStructTypes(F.getFunctionType(), structs);
+  F.getAttributes().print(rso);
+  for (Instruction &I : instructions(F)) {
+    collectStructTypes(I.getType(), structs);
+    for (Value *op : I.operands()) {
+      collectStructTypes(op->getType(), structs);
+    }
+    if (AllocaInst *AI = dyn_cast<AllocaInst>(&I)) {
+      collectStructTypes(AI->getAllocatedType(), structs);
+    } else if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+      collectStructTypes(GEP->getSourceElementType(), structs);
+    } else if (CallBase *CB = dyn_cast<CallBase>(&I)) {
+      CB->getAttributes().print(rso);
+    }
+  }
+  for (StructType *ST : structs) {
+    rso << ST->getName() << (ST->isPacked() ? " = <{" : " = {");
+    for (Type *element : ST->elements()) {
+      rso << " " << *element;
+    }
+    rso << (ST->isOpaque() ? " opaque" : " }");
+  }
+
+  MD5 hash;
+  hash.update(rso.str());
+  MD5::MD5Result result;
+  hash.final(result);
+  return utohexstr(result.low(), /*LowerCase=*/true);
+}
+
+bool WyvernLazyficationPass::foldEquivalentFunctions(
+    Module &M, const SmallPtrSetImpl<Function *> &originals) {
+  SmallVector<Function *> candidates;
+  for (Function &F : M) {
+    if (!originals.count(&F) && isGeneratedFunction(F) &&
+        !F.getName().startswith("_wyvern_memo_ret_")) {
+      candidates.push_back(&F);
+    }
+  }
+
+  // Folding delegates may make the clones that call them equivalent, so
+  // functions are compared again until nothing else is folded
+  bool changed = false;
+  for (bool folded = true; folded;) {
+    folded = false;
+    GlobalNumberState globalNumbers;
+    DenseMap<FunctionComparator::FunctionHash, SmallVector<Function *, 2>>
+        buckets;
+    SmallVector<Function *> kept;
+    for (Function *F : candidates) {
+      SmallVector<Function *, 2> &bucket =
+          buckets[FunctionComparator::functionHash(*F)];
+      auto equivalent = find_if(bucket, [&](Function *K) {
+        return FunctionComparator(K, F, &globalNumbers).compare() == 0;
+      });
+      if (equivalent == bucket.end()) {
+        bucket.push_back(F);
+        kept.push_back(F);
+        continue;
+      }
+
+      // Equivalent functions only differ in the names of their thunk types,
+      // which have the same layout
+      Function *K = *equivalent;
+      LLVM_DEBUG(dbgs() << "Folding " << F->getName() << " into "
+                        << K->getName() << "\n");
+      if (F->getName().startswith("_wyvern_slice_")) {
+        ++NumDelegatesFolded;
+        ++numDelegatesFolded;
+      } else {
+        ++NumClonesFolded;
+        ++numClonesFolded;
+      }
+      NumInstsFolded += getNumberOfInsts(*F);
+      numInstsFolded += getNumberOfInsts(*F);
+      globalNumbers.erase(F);
+      F->replaceAllUsesWith(ConstantExpr::getBitCast(K, F->getType()));
+      for (auto &entry : thunkDelegates) {
+        if (entry.second == F) {
+          entry.second = K;
+        }
+      }
+      for (auto &entry : clonedCallees) {
+        if (entry.second == F) {
+          entry.second = K;
+        }
+      }
+      delegateCallSites.erase(F);
+      cloneThunkArgs.erase(F);
+      cloneOrigins.erase(F);
+      F->eraseFromParent();
+      folded = changed = true;
+    }
+    candidates = kept;
+  }
+  return changed;
+}
+
+void WyvernLazyficationPass::printCodeSizeReport(
+    Module &M, const SmallPtrSetImpl<Function *> &originals,
+    uint64_t originalSize) {
+  unsigned numDelegates = 0, numClones = 0;
+  uint64_t delegateSize = 0, cloneSize = 0, finalSize = 0;
+  for (Function &F : M) {
+    unsigned size = getNumberOfInsts(F);
+    finalSize += size;
+    if (originals.count(&F)) {
+      continue;
+    }
+    if (F.getName().startswith("_wyvern_slice_")) {
+      ++numDelegates;
+      delegateSize += size;
+    } else if (F.getName().startswith("_wyvern_calleeclone_")) {
+      ++numClones;
+      cloneSize += size;
+    }
+  }
+
+  double growth =
+      originalSize ? 100.0 * ((double)finalSize - originalSize) / originalSize
+                   : 0.0;
+  errs() << "Wyvern code size report for " << M.getModuleIdentifier() << ":\n"
+         << "  original module: " << originalSize << " instructions\n"
+         << "  delegates:       " << numDelegates << " functions, "
+         << delegateSize << " instructions\n"
+         << "  callee clones:   " << numClones << " functions, " << cloneSize
+         << " instructions\n"
+         << "  folded:          " << numDelegatesFolded << " delegates, "
+         << numClonesFolded << " callee clones, " << numInstsFolded
+         << " instructions\n"
+         << "  final module:    " << finalSize << " instructions ("
+         << format("%+.1f", growth) << "%)\n";
+}
+
+void WyvernLazyficationPass::nameGeneratedFunctions(
+    Module &M, const SmallPtrSetImpl<Function *> &originals) {
+  SmallVector<Function *> pending;
+  for (Function &F : M) {
+    if (!originals.count(&F) && isGeneratedFunction(F)) {
+      pending.push_back(&F);
+    }
+  }
+  SmallPtrSet<const Function *, 32> unnamed(pending.begin(), pending.end());
+  bool useComdats = Triple(M.getTargetTriple()).supportsCOMDAT();
+
+  // Functions are named after the generated functions they reference, so that
+  // the name of a function determines all the code it may reach. Functions in
+  // reference cycles are named last, and kept local to the module.
+  while (!pending.empty()) {
+    SmallVector<std::pair<Function *, bool>> ready;
+    SmallVector<Function *> blocked;
+    for (Function *F : pending) {
+      SmallPtrSet<const Constant *, 16> visited;
+      SetVector<const GlobalValue *> globals;
+      for (Instruction &I : instructions(*F)) {
+        for (Value *op : I.operands()) {
+          if (Constant *C = dyn_cast<Constant>(op)) {
+            collectReferencedGlobals(C, visited, globals);
+          }
+        }
+      }
+      globals.remove(F);
+      if (any_of(globals, [&unnamed](const GlobalValue *GV) {
+            return unnamed.count(dyn_cast<Function>(GV));
+          })) {
+        blocked.push_back(F);
+        continue;
+      }
+      // Functions that reference symbols local to the module would behave
+      // differently in each translation unit
+      bool local = any_of(globals, [](const GlobalValue *GV) {
+        return GV->hasLocalLinkage();
+      });
+      ready.push_back({F, !local});
+    }
+
+    if (ready.empty()) {
+      for (Function *F : blocked) {
+        ready.push_back({F, false});
+      }
+      blocked.clear();
+    }
+
+    for (auto &[F, shared] : ready) {
+      std::string hash = getContentHash(*F);
+      F->setName(getBaseName(*F) + "_" + hash);
+      if (shared) {
+        // Hidden copies are only merged within a linkage unit, so they can
+        // remain local to it
+        F->setLinkage(GlobalValue::LinkOnceODRLinkage);
+        F->setVisibility(GlobalValue::HiddenVisibility);
+        if (useComdats) {
+          F->setComdat(M.getOrInsertComdat(F->getName()));
+        }
+      }
+      unnamed.erase(F);
+      LLVM_DEBUG(dbgs() << "Naming generated function " << F->getName()
+                        << (shared ? " (linkonce_odr)" : " (internal)")
+                        << "\n");
+    }
+    pending = blocked;
+  }
+}
+
+/// Returns the thunk evaluated by @param PN, if it joins the memoized value of
+/// a thunk with the result of its delegate, as emitted by
+/// createThunkEvaluation, or nullptr otherwise. The branch on the memoization
+/// flag of the thunk is stored in @param check.
+static Value *getMemoizedEvaluation(PHINode *PN, DominatorTree &DT,
+                                    BranchInst *&check) {
+  DomTreeNode *node = DT.getNode(PN->getParent());
+  if (PN->getNumIncomingValues() != 2 || !node || !node->getIDom()) {
+    return nullptr;
+  }
+  check = dyn_cast<BranchInst>(node->getIDom()->getBlock()->getTerminator());
+  if (!check || !check->isConditional()) {
+    return nullptr;
+  }
+  ICmpInst *memoFlag = dyn_cast<ICmpInst>(check->getCondition());
+  if (!memoFlag || memoFlag->getPredicate() != ICmpInst::ICMP_EQ) {
+    return nullptr;
+  }
+  LoadInst *fptrLoad = dyn_cast<LoadInst>(memoFlag->getOperand(0));
+  Function *memoFunction =
+      dyn_cast<Function>(memoFlag->getOperand(1)->stripPointerCasts());
+  if (!fptrLoad || !memoFunction ||
+      !memoFunction->getName().startswith("_wyvern_memo_ret_")) {
+    return nullptr;
+  }
+  GEPOperator *fptrGEP = dyn_cast<GEPOperator>(fptrLoad->getPointerOperand());
+  if (!fptrGEP || !fptrGEP->hasAllZeroIndices()) {
+    return nullptr;
+  }
+  return fptrGEP->getPointerOperand()->stripPointerCasts();
+}
+
+bool WyvernLazyficationPass::mergeThunkEvaluations(Function &F) {
+  DominatorTree DT(F);
+  bool changed = false;
+
+  // Memoized evaluations check the memoization flag inline, and only call the
+  // delegate when it is not set, so their calls never dominate each other.
+  // They are merged as a whole, through the phi that yields their value.
+  std::map<Value *, SmallVector<std::pair<PHINode *, BranchInst *>>>
+      memoEvaluations;
+  for (BasicBlock &BB : F) {
+    for (PHINode &PN : BB.phis()) {
+      BranchInst *check;
+      if (Value *thunk = getMemoizedEvaluation(&PN, DT, check)) {
+        memoEvaluations[thunk].push_back({&PN, check});
+      }
+    }
+  }
+
+  SmallVector<BasicBlock *> mergedJoins;
+  for (auto &[thunk, evaluations] : memoEvaluations) {
+    SmallVector<std::pair<PHINode *, BranchInst *>> kept;
+    for (auto &[PN, check] : evaluations) {
+      BasicBlock *checkBB = check->getParent();
+      auto dominating = find_if(kept, [&DT, checkBB](auto &prev) {
+        return DT.dominates(prev.first->getParent(), checkBB);
+      });
+      if (dominating == kept.end()) {
+        kept.push_back({PN, check});
+        continue;
+      }
+      LLVM_DEBUG(dbgs() << "Merging thunk evaluation " << *PN << " into "
+                        << *dominating->first << "\n");
+
+      // The flag is no longer checked, which leaves the blocks that load the
+      // memoized value and call the delegate unreachable
+      PN->replaceAllUsesWith(dominating->first);
+      BasicBlock *join = PN->getParent();
+      PN->eraseFromParent();
+      Value *memoFlag = check->getCondition();
+      BranchInst::Create(join, check);
+      check->eraseFromParent();
+      RecursivelyDeleteTriviallyDeadInstructions(memoFlag);
+      mergedJoins.push_back(join);
+      ++NumThunkEvaluationsMerged;
+      changed = true;
+    }
+  }
+
+  if (!mergedJoins.empty()) {
+    removeUnreachableBlocks(F);
+    for (BasicBlock *join : mergedJoins) {
+      MergeBlockIntoPredecessor(join);
+    }
+    DT.recalculate(F);
+  }
+
+  // The first evaluation of a thunk in a call finds it unevaluated, unless
+  // the caller has evaluated it already, so only the evaluations that may
+  // follow another one in the same call are expected to hit the memoized
+  // value. Evaluations in loops may follow themselves.
+  memoEvaluations.clear();
+  for (BasicBlock &BB : F) {
+    for (PHINode &PN : BB.phis()) {
+      BranchInst *check;
+      if (Value *thunk = getMemoizedEvaluation(&PN, DT, check)) {
+        memoEvaluations[thunk].push_back({&PN, check});
+      }
+    }
+  }
+  for (auto &[thunk, evaluations] : memoEvaluations) {
+    for (auto &[PN, check] : evaluations) {
+      if (any_of(evaluations, [check = check](auto &prev) {
+            return isPotentiallyReachable(prev.first, check);
+          })) {
+        continue;
+      }
+      check->setMetadata(LLVMContext::MD_prof, nullptr);
+      BasicBlock *checkBB = check->getParent();
+      BasicBlock *join = PN->getParent();
+      for (BasicBlock &BB : F) {
+        if (&BB == checkBB || !DT.dominates(checkBB, &BB) ||
+            DT.dominates(join, &BB)) {
+          continue;
+        }
+        for (Instruction &I : BB) {
+          if (CallInst *CI = dyn_cast<CallInst>(&I)) {
+            CI->removeFnAttr(Attribute::Cold);
+          }
+        }
+      }
+    }
+  }
+
+  // Evaluations through direct calls to the delegate are merged into the
+  // calls that dominate them, to the same delegate on the same thunk or on
+  // the same environment
+  std::map<SmallVector<Value *, 2>, SmallVector<CallInst *>> evaluations;
+  for (Instruction &I : instructions(F)) {
+    CallInst *CI = dyn_cast<CallInst>(&I);
+    if (CI && ProgramSlice::isIdempotentDelegate(CI->getCalledFunction())) {
+      SmallVector<Value *, 2> key = {CI->getCalledFunction()};
+      for (Value *arg : CI->args()) {
+        key.push_back(arg->stripPointerCasts());
+      }
+      evaluations[key].push_back(CI);
+    }
+  }
+
+  for (auto &[thunk, calls] : evaluations) {
+    SmallVector<CallInst *> kept;
+    for (CallInst *CI : calls) {
+      auto dominating = find_if(
+          kept, [&DT, CI](CallInst *prev) { return DT.dominates(prev, CI); });
+      if (dominating == kept.end()) {
+        kept.push_back(CI);
+        continue;
+      }
+      LLVM_DEBUG(dbgs() << "Merging thunk evaluation " << *CI << " into "
+                        << **dominating << "\n");
+      CI->replaceAllUsesWith(*dominating);
+      CI->eraseFromParent();
+      ++NumThunkEvaluationsMerged;
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
 static void generateThunkInitializationCode(IRBuilder<> &builder,
                                             ProgramSlice &slice,
                                             AllocaInst *thunkAlloca,
                                             Function *delegateFunction,
-                                            bool memo) {
+                                            bool memo,
+                                            ArrayRef<Value *> environment) {
   StructType *thunkStructType = slice.getThunkStructType(memo);
 
   // initialize thunk with:
@@ -335,18 +1563,6 @@ static void generateThunkInitializationCode(IRBuilder<> &builder,
                                                 "_wyvern_thunk_fptr_gep");
   builder.CreateStore(delegateFunction, thunkFPtrGEP);
 
-  if (memo) {
-    // memoized thunks also have their memoization flag:
-    // struct thunk {
-    //   ...
-    //   memo_flag = false
-    //   ...
-    // }
-    Value *thunkFlagGEP = builder.CreateStructGEP(thunkStructType, thunkAlloca,
-                                                  2, "_wyvern_thunk_flag_gep");
-    builder.CreateStore(builder.getInt1(0), thunkFlagGEP);
-  }
-
   // add initialization of thunk environment:
   // struct thunk {
   //   ...
@@ -354,8 +1570,8 @@ static void generateThunkInitializationCode(IRBuilder<> &builder,
   //   arg2 = y
   //   ...
   // }
-  uint64_t i = (memo ? 3 : 1);
-  for (auto &arg : slice.getOrigFunctionArgs()) {
+  uint64_t i = (memo ? 2 : 1);
+  for (auto &arg : environment) {
     Value *thunkArgGEP =
         builder.CreateStructGEP(thunkStructType, thunkAlloca, i,
                                 "_wyvern_thunk_arg_gep_" + arg->getName());
@@ -371,15 +1587,7 @@ static void generateThunkInitializationCode(IRBuilder<> &builder,
     rso << "== Wyvern Debugging ==\nInitializing thunk with:\n";
     rso << "\tdelegateFunction = " << delegateFunction->getName().str() << "\n";
 
-    if (memo) {
-      rso << "\t";
-      builder.getInt1(0)->getType()->print(rso);
-      rso << " memo_flag = ";
-      builder.getInt1(0)->print(rso);
-      rso << "\n";
-    }
-
-    for (auto &arg : slice.getOrigFunctionArgs()) {
+    for (auto &arg : environment) {
       rso << "\t";
       arg->getType()->print(rso);
       rso << " " << arg->getName() << " = ";
@@ -401,6 +1609,207 @@ static void generateThunkInitializationCode(IRBuilder<> &builder,
   }
 }
 
+bool WyvernLazyficationPass::canPassEnvironmentInRegisters(
+    CallInst &CI, unsigned index, ArrayRef<Value *> environment) {
+  Function *callee = CI.getCalledFunction();
+  if (environment.empty() || environment.size() > WyvernRegisterEnvSize ||
+      callee->isDeclaration() || index >= callee->arg_size() ||
+      !CI.getArgOperand(index)->hasOneUse()) {
+    return false;
+  }
+
+  // Clones are specific to the types of the environment, so they are only
+  // worth their size for small callees
+  if (getNumberOfInsts(*callee) > WyvernRegisterEnvCalleeSize) {
+    return false;
+  }
+
+  return all_of(environment, [](Value *arg) {
+    return arg->getType()->isSingleValueType();
+  });
+}
+
+Function *WyvernLazyficationPass::cloneCalleeWithEnvironment(
+    Function &Callee, unsigned index, StructType *envType, Module &M) {
+  // Environment types are literal structs, so they never collide with the
+  // thunk header types of the clones that receive thunks in memory
+  auto key = std::make_tuple(&Callee, index, envType, (FunctionType *)nullptr);
+  if (Function *previousClone = clonedCallees[key]) {
+    return previousClone;
+  }
+
+  Function *newCallee = cloneCalleeFunction(Callee, index, envType, M);
+  Argument *envArg = newCallee->getArg(index);
+  envArg->setName("_wyvern_env");
+  removeAttributesFromThunkArgument(*newCallee, index);
+  newCallee->removeParamAttrs(index, AttributeFuncs::typeIncompatible(envType));
+
+  // The clone must be cached before forwarding its environment, since the
+  // callees it is forwarded to may be (mutually) recursive
+  clonedCallees[key] = newCallee;
+  cloneOrigins[newCallee] = getOriginalCallee(&Callee);
+  cloneThunkArgs[newCallee] = cloneThunkArgs[&Callee];
+
+  // Uses of the original parameter are collected before the environment is
+  // unpacked, since unpacking it also uses the new parameter. Calls that
+  // forward the parameter to a lazifiable parameter of another small function
+  // pass the environment on as is, to a clone of that function.
+  SmallVector<Use *> uses;
+  SmallVector<std::pair<Use *, unsigned>> forwardableCalls;
+  for (Use &U : envArg->uses()) {
+    unsigned argNo;
+    if (WyvernForwardThunks && isForwardableUse(U, argNo) &&
+        getNumberOfInsts(*cast<CallInst>(U.getUser())->getCalledFunction()) <=
+            WyvernRegisterEnvCalleeSize) {
+      forwardableCalls.push_back(std::make_pair(&U, argNo));
+    } else {
+      uses.push_back(&U);
+    }
+  }
+
+  for (auto &[U, argNo] : forwardableCalls) {
+    CallInst *CI = cast<CallInst>(U->getUser());
+    Function *nextCallee = cloneCalleeWithEnvironment(
+        *CI->getCalledFunction(), argNo, envType, M);
+    CI->setCalledFunction(nextCallee);
+    removeAttributesFromThunkArgument(*CI, argNo);
+    CI->removeParamAttrs(argNo, AttributeFuncs::typeIncompatible(envType));
+    removeMemoryAttributes(*CI);
+    ++NumThunksForwarded;
+  }
+
+  // The environment is unpacked once, so that evaluations of the thunk in the
+  // clone pass the same values to the delegate, which is packed with them
+  IRBuilder<> builder(&*newCallee->getEntryBlock().getFirstInsertionPt());
+  Value *delegate =
+      builder.CreateExtractValue(envArg, 0, "_wyvern_env_delegate");
+  FunctionType *delegateType =
+      cast<FunctionType>(envType->getElementType(0)->getPointerElementType());
+  SmallVector<Value *> environment;
+  for (unsigned i = 1; i < envType->getNumElements(); ++i) {
+    environment.push_back(builder.CreateExtractValue(envArg, i, "_wyvern_env"));
+  }
+
+  for (Use *U : uses) {
+    Instruction *UserI = cast<Instruction>(U->getUser());
+    if (PHINode *PN = dyn_cast<PHINode>(UserI)) {
+      builder.SetInsertPoint(PN->getIncomingBlock(*U)->getTerminator());
+    } else {
+      builder.SetInsertPoint(UserI);
+    }
+    U->set(builder.CreateCall(delegateType, delegate, environment,
+                              "_wyvern_thunkcall"));
+  }
+  verifyFunction(*newCallee);
+
+  return newCallee;
+}
+
+/// Returns whether the thunk passed to the parameter of index @param index of
+/// function @param F may be forwarded to another callee clone, which evaluates
+/// it out of sight of the profile of the call site.
+static bool mayForwardThunk(Function &F, unsigned index) {
+  return WyvernForwardThunks &&
+         any_of(F.getArg(index)->uses(), [](const Use &U) {
+           const CallBase *CB = dyn_cast<CallBase>(U.getUser());
+           return CB && CB->isArgOperand(&U);
+         });
+}
+
+/// Returns whether the thunk passed to the parameter of index @param index of
+/// function @param F is evaluated at most once per call: the parameter has a
+/// single use, which is not part of a cycle, and cannot be forwarded.
+static bool isEvaluatedAtMostOnce(Function &F, unsigned index) {
+  Argument *arg = F.getArg(index);
+  if (!arg->hasOneUse()) {
+    return false;
+  }
+
+  Use &use = *arg->use_begin();
+  Instruction *UserI = dyn_cast<Instruction>(use.getUser());
+  if (!UserI || (WyvernForwardThunks && isa<CallBase>(UserI))) {
+    return false;
+  }
+
+  BasicBlock *BB = UserI->getParent();
+  if (PHINode *PN = dyn_cast<PHINode>(UserI)) {
+    BB = PN->getIncomingBlock(use);
+  }
+  return none_of(successors(BB), [BB](BasicBlock *succ) {
+    return isPotentiallyReachable(succ, BB);
+  });
+}
+
+bool WyvernLazyficationPass::shouldMemoize(CallInst &CI, unsigned index) {
+  if (!WyvernLazyficationMemoization) {
+    return false;
+  }
+
+  // Other uses of the lazified value in the caller also evaluate the thunk,
+  // and lazy entry points in other modules are unknown
+  Function *callee = CI.getCalledFunction();
+  if (!CI.getArgOperand(index)->hasOneUse() || callee->isDeclaration()) {
+    return true;
+  }
+
+  // Variadic clones evaluate the thunk once, when handing over to the original
+  // callee
+  if (index >= callee->arg_size()) {
+    return false;
+  }
+
+  // The profile only counts the evaluations in the callee itself, so thunks
+  // that may be forwarded are decided statically
+  auto profile = profileInfo.find(&CI);
+  if (profile != profileInfo.end() && !mayForwardThunk(*callee, index) &&
+      index < profile->second->_totalEvals.size() &&
+      profile->second->_uniqueEvals[index] > 0) {
+    return profile->second->_totalEvals[index] >
+           profile->second->_uniqueEvals[index];
+  }
+
+  return !isEvaluatedAtMostOnce(*callee, index);
+}
+
+Loop *WyvernLazyficationPass::getThunkHoistingLoop(
+    Instruction &initPoint, ArrayRef<Value *> environment, LoopInfo &LI) {
+  // Slices never depend on values carried across iterations of the loops
+  // around the call site (see ProgramSlice::canOutline), so the thunk only
+  // varies per iteration if its environment does
+  Loop *hoistingLoop = nullptr;
+  for (Loop *L = LI.getLoopFor(initPoint.getParent()); L;
+       L = L->getParentLoop()) {
+    if (!L->getLoopPreheader() ||
+        !all_of(environment,
+                [L](Value *arg) { return L->isLoopInvariant(arg); })) {
+      break;
+    }
+    hoistingLoop = L;
+  }
+  return hoistingLoop;
+}
+
+double WyvernLazyficationPass::getLazificationBenefit(CallInst &CI,
+                                                     uint8_t index) {
+  if (WyvernEnablePGO) {
+    WyvernCallSiteProfInfo *prof_info = profileInfo[&CI].get();
+    if (prof_info && index < prof_info->_uniqueEvals.size()) {
+      return (double)prof_info->_numCalls -
+             (double)prof_info->_uniqueEvals[index];
+    }
+  }
+  return getSlicingContext(*CI.getFunction())
+      .getRelativeFrequency(CI.getParent());
+}
+
+SlicingContext &WyvernLazyficationPass::getSlicingContext(Function &F) {
+  std::unique_ptr<SlicingContext> &context = slicingContexts[&F];
+  if (!context) {
+    context = std::make_unique<SlicingContext>(F);
+  }
+  return *context;
+}
+
 /// Attempts to lazify a given call site, in terms of its actual parameter with
 /// the given index.
 bool WyvernLazyficationPass::lazifyCallsite(CallInst &CI, uint8_t index,
@@ -417,29 +1826,60 @@ bool WyvernLazyficationPass::lazifyCallsite(CallInst &CI, uint8_t index,
   Function *caller = CI.getParent()->getParent();
   TargetLibraryInfo &TLI =
       getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(*caller);
+  SlicingContext &context = getSlicingContext(*caller);
   ProgramSlice slice =
-      ProgramSlice(*lazyfiableArg, *caller, CI, AA, TLI, WyvernThunkDebugging);
+      ProgramSlice(*lazyfiableArg, context, CI, AA, TLI, WyvernThunkDebugging);
 
   if (!slice.canOutline()) {
     LLVM_DEBUG(dbgs() << "Cannot lazify argument. Slice is not outlineable!\n");
     return false;
   }
 
+  if (slice.migratesStackBuffer() && !WyvernLazyficationMemoization) {
+    LLVM_DEBUG(dbgs() << "Cannot lazify argument. Delegates that build a "
+                         "local buffer must be memoized!\n");
+    return false;
+  }
+
   Function *callee = CI.getCalledFunction();
-  if (!callee || callee->isDeclaration()) {
+  FindLazyfiableAnalysis &FLA = getAnalysis<FindLazyfiableAnalysis>();
+  if (!callee) {
     LLVM_DEBUG(dbgs() << "Cannot lazify argument. Callee function definition "
                          "is not available for cloning!\n");
     return false;
   }
 
-  if (callee->isVarArg()) {
-    LLVM_DEBUG(dbgs() << "Cannot lazify argument. Callee function has variable "
-                         "number of input arguments!\n");
+  // The call site may already call a clone, if some of its other arguments
+  // were lazified. In that case, the clone is cloned again, so that a single
+  // callee receives all thunks of the call site.
+  Function *origCallee = getOriginalCallee(callee);
+  if (origCallee->isDeclaration() && callee != origCallee) {
+    LLVM_DEBUG(dbgs() << "Cannot lazify argument. Call site already calls a "
+                         "lazy wrapper!\n");
     return false;
   }
 
-  Argument *callee_arg = callee->getArg(index);
-  if (callee_arg->getNumUses() == 0) {
+  if (FLA.isAnnotatedEager(origCallee, index)) {
+    LLVM_DEBUG(dbgs() << "Will not lazify argument annotated as eager!\n");
+    return false;
+  }
+
+  bool isVarArgSlot = index >= callee->arg_size();
+  if (callee->isDeclaration()) {
+    // Functions with no body can only be lazified through the lazy entry
+    // points generated for their annotated parameters
+    if (!FLA.isAnnotatedLazy(origCallee, index) || callee->isVarArg()) {
+      LLVM_DEBUG(dbgs() << "Cannot lazify argument. Callee function definition "
+                           "is not available for cloning!\n");
+      return false;
+    }
+  } else if (isVarArgSlot) {
+    if (!isVarArgPrefixSafe(*callee)) {
+      LLVM_DEBUG(dbgs() << "Cannot lazify variadic argument. Callee function "
+                           "may have side effects before va_start!\n");
+      return false;
+    }
+  } else if (callee->getArg(index)->getNumUses() == 0) {
     LLVM_DEBUG(dbgs() << "Will not lazify argument because it has no uses in "
                          "callee function! Possibly @this pointer?\n");
     return false;
@@ -460,39 +1900,216 @@ bool WyvernLazyficationPass::lazifyCallsite(CallInst &CI, uint8_t index,
   Function *delegateFunction, *newCallee;
   StructType *thunkStructType;
 
-  delegateFunction =
-      WyvernLazyficationMemoization ? slice.memoizedOutline() : slice.outline();
-  thunkStructType = slice.getThunkStructType(WyvernLazyficationMemoization);
+  // Thunks of call sites in loops are initialized once, before the loop, if
+  // they do not change across iterations. They are then memoized, so that all
+  // iterations share a single evaluation.
+  Instruction *initPoint = lazyfiableArg;
+  if (isa<PHINode>(lazyfiableArg)) {
+    initPoint = &*(lazyfiableArg->getParent()->getFirstInsertionPt());
+  }
+  LoopInfo &LI = context.getLoopInfo();
+  SmallVector<Value *> environment = slice.getEnvironment();
+  // Migrated buffers are rebuilt in every iteration, since the callee may
+  // write to them
+  Loop *hoistingLoop =
+      slice.migratesStackBuffer()
+          ? nullptr
+          : getThunkHoistingLoop(*initPoint, environment, LI);
+  if (hoistingLoop) {
+    initPoint = hoistingLoop->getLoopPreheader()->getTerminator();
+  }
 
-  AllocaInst *thunkAlloca =
-      builder.CreateAlloca(thunkStructType, nullptr, "_wyvern_thunk_alloca");
+  bool memo = hoistingLoop || slice.migratesStackBuffer()
+                  ? (bool)WyvernLazyficationMemoization
+                  : shouldMemoize(CI, index);
+  if (!memo) {
+    ++NumCallByNameThunks;
+  }
 
-  if (isa<PHINode>(lazyfiableArg)) {
-    builder.SetInsertPoint(
-        &*(lazyfiableArg->getParent()->getFirstInsertionPt()));
+  // Small environments are passed to the callee in registers, packed with the
+  // delegate in a first-class struct, instead of through a thunk in memory.
+  // Thunks shared across the iterations of a loop, or memoized, need memory.
+  bool passInRegisters = !memo && !hoistingLoop &&
+                         canPassEnvironmentInRegisters(CI, index, environment);
+  if (passInRegisters) {
+    delegateFunction = slice.outlineWithEnvironmentParams();
   } else {
-    builder.SetInsertPoint(lazyfiableArg);
+    delegateFunction =
+        memo ? slice.memoizedOutline(memoFunctions) : slice.outline();
+  }
+  thunkStructType = slice.getThunkStructType(memo);
+  if (!passInRegisters &&
+      M.getDataLayout().getTypeAllocSize(thunkStructType) > 64) {
+    ++NumThunksExceedingCacheLine;
+  }
+
+  delegateCallSites[delegateFunction] = &CI;
+
+  // The slice refers to the values of the caller, some of which are erased
+  // below, so the library calls deferred to the delegate are collected first
+  SmallVector<WeakTrackingVH> deferredCalls;
+  for (Instruction *call : slice.getDeferredLibCalls()) {
+    deferredCalls.push_back(call);
+  }
+
+  // The call and the uses of the lazified value are about to depend on the
+  // thunk. The closures memoized for the caller that reach neither of them
+  // are still valid for the next call sites.
+  SmallVector<const Value *> rewritten(lazyfiableArg->user_begin(),
+                                       lazyfiableArg->user_end());
+  context.invalidateClosures(rewritten);
+
+  // The buffer is now built by the delegate, when the thunk is forced
+  if (slice.migratesStackBuffer()) {
+    for (Instruction *init : slice.getBufferInitializers()) {
+      context.forgetValue(init);
+      init->eraseFromParent();
+    }
+    ++NumStackBuffersMigrated;
   }
 
-  generateThunkInitializationCode(builder, slice, thunkAlloca, delegateFunction,
-                                  WyvernLazyficationMemoization);
+  if (passInRegisters) {
+    SmallVector<Type *> envTypes = {delegateFunction->getType()};
+    for (Value *arg : environment) {
+      envTypes.push_back(arg->getType());
+    }
+    StructType *envType = StructType::get(M.getContext(), envTypes);
+    newCallee = cloneCalleeWithEnvironment(*callee, index, envType, M);
+
+    builder.SetInsertPoint(&CI);
+    Value *envValue = builder.CreateInsertValue(UndefValue::get(envType),
+                                                delegateFunction, 0,
+                                                "_wyvern_env");
+    for (unsigned i = 0; i < environment.size(); ++i) {
+      envValue = builder.CreateInsertValue(envValue, environment[i], i + 1,
+                                           "_wyvern_env");
+    }
 
-  auto tuple = std::make_tuple(callee, index, thunkStructType);
-  Function *previouslyClonedCallee = clonedCallees[tuple];
-  if (previouslyClonedCallee) {
-    newCallee = previouslyClonedCallee;
+    CI.setCalledFunction(newCallee);
+    CI.setArgOperand(index, envValue);
+    removeAttributesFromThunkArgument(CI, index);
+    CI.removeParamAttrs(index, AttributeFuncs::typeIncompatible(envType));
+    removeMemoryAttributes(CI);
+    ++NumRegisterThunks;
   } else {
-    newCallee = cloneCalleeFunction(*callee, index, *delegateFunction,
-                                    thunkAlloca, thunkStructType, M);
-    clonedCallees[tuple] = newCallee;
+    AllocaInst *thunkAlloca =
+        builder.CreateAlloca(thunkStructType, nullptr, "_wyvern_thunk_alloca");
+
+    builder.SetInsertPoint(initPoint);
+    if (hoistingLoop) {
+      ++NumThunksHoisted;
+    }
+
+    // The thunk is only alive from its initialization to its last use, so
+    // that stack coloring can overlap the thunks of different call sites.
+    // Thunks initialized outside the loop of the call outlive each call.
+    const DataLayout &DL = M.getDataLayout();
+    ConstantInt *thunkSize =
+        builder.getInt64(DL.getTypeAllocSize(thunkStructType));
+    Loop *callLoop = LI.getLoopFor(CI.getParent());
+    bool onlyPassedToCall =
+        lazyfiableArg->hasOneUse() &&
+        (!callLoop || callLoop->contains(initPoint->getParent()));
+    builder.CreateLifetimeStart(thunkAlloca, thunkSize);
+
+    generateThunkInitializationCode(builder, slice, thunkAlloca,
+                                    delegateFunction, memo, environment);
+    thunkDelegates[thunkAlloca] = delegateFunction;
+
+    // Clones only access the thunk header, so that a single clone serves
+    // every call site that lazifies a value of the same type. Clones for
+    // variadic arguments are also specific to the types of the arguments of
+    // the call site, which they take as fixed parameters.
+    StructType *thunkHeaderType =
+        ProgramSlice::getThunkHeaderType(lazyfiableArg->getType(), memo);
+    if (callee->isDeclaration()) {
+      auto wrapperKey = std::make_pair(callee, (unsigned)index);
+      if (!lazyWrappers.count(wrapperKey)) {
+        lazyWrappers[wrapperKey] = createLazyWrapper(*callee, index, M);
+        cloneOrigins[lazyWrappers[wrapperKey]] = callee;
+      }
+      newCallee = lazyWrappers[wrapperKey];
+    } else if (isVarArgSlot) {
+      SmallVector<Type *> argTypes;
+      for (Value *arg : CI.args()) {
+        argTypes.push_back(arg->getType());
+      }
+      argTypes[index] = thunkHeaderType->getPointerTo();
+      auto key = std::make_tuple(
+          callee, (unsigned)index, thunkHeaderType,
+          FunctionType::get(callee->getReturnType(), argTypes, false));
+      newCallee = clonedCallees[key];
+      if (!newCallee) {
+        newCallee = cloneVarArgCalleeFunction(
+            *callee, CI, index, thunkHeaderType->getPointerTo(),
+            thunkHeaderType, memoFunctions, M);
+        clonedCallees[key] = newCallee;
+        cloneOrigins[newCallee] = origCallee;
+        cloneThunkArgs[newCallee] = cloneThunkArgs[callee];
+        cloneThunkArgs[newCallee].push_back(index);
+      }
+    } else {
+      newCallee = getOrCloneCallee(*callee, index,
+                                   thunkHeaderType->getPointerTo(),
+                                   thunkHeaderType, M);
+    }
+
+    // Shared clones and lazy wrappers receive thunks of any layout
+    Value *thunkArg = thunkAlloca;
+    Type *thunkArgType = newCallee->getArg(index)->getType();
+    if (thunkArgType != thunkAlloca->getType()) {
+      thunkArg = CastInst::CreatePointerCast(thunkAlloca, thunkArgType,
+                                             "_wyvern_thunk_header", &CI);
+    }
+
+    CI.setCalledFunction(newCallee);
+    CI.setArgOperand(index, thunkArg);
+    removeAttributesFromThunkArgument(CI, index);
+    removeMemoryAttributes(CI);
+    removeAttributesFromThunkArgument(*newCallee, index);
+    updateThunkArgUses(caller, thunkAlloca, thunkStructType, memoFunctions,
+                       delegateFunction, lazyfiableArg);
+
+    // Thunks that are only passed to the call die with it. Otherwise, the
+    // caller may evaluate them anywhere after the call.
+    if (onlyPassedToCall) {
+      builder.SetInsertPoint(CI.getNextNode());
+      builder.CreateLifetimeEnd(thunkAlloca, thunkSize);
+    } else {
+      for (BasicBlock &BB : *caller) {
+        if (isa<ReturnInst>(BB.getTerminator())) {
+          builder.SetInsertPoint(BB.getTerminator());
+          builder.CreateLifetimeEnd(thunkAlloca, thunkSize);
+        }
+      }
+    }
   }
 
-  CI.setCalledFunction(newCallee);
-  CI.setArgOperand(index, thunkAlloca);
-  removeAttributesFromThunkArgument(CI, index);
-  removeAttributesFromThunkArgument(*newCallee, index);
-  updateThunkArgUses(caller, thunkAlloca, thunkStructType, delegateFunction,
-                     lazyfiableArg);
+  // Library calls that write errno are not trivially dead, so the ones left
+  // unused in the caller are erased along with the values computed from them
+  auto forget = [&context](Value *V) { context.forgetValue(V); };
+  if (!deferredCalls.empty()) {
+    RecursivelyDeleteTriviallyDeadInstructions(lazyfiableArg, nullptr, nullptr,
+                                               forget);
+  }
+  for (bool erased = true; erased;) {
+    erased = false;
+    for (WeakTrackingVH &call : deferredCalls) {
+      Instruction *I = cast_or_null<Instruction>(call);
+      if (!I || !I->use_empty()) {
+        continue;
+      }
+      SmallVector<Value *> operands(I->operands());
+      context.forgetValue(I);
+      I->eraseFromParent();
+      for (Value *op : operands) {
+        RecursivelyDeleteTriviallyDeadInstructions(op, nullptr, nullptr,
+                                                   forget);
+      }
+      ++NumLibCallsDeferred;
+      erased = true;
+    }
+  }
 
   uint64_t sliceSize = getNumberOfInsts(*delegateFunction);
   TotalSliceSize += sliceSize;
@@ -506,6 +2123,89 @@ bool WyvernLazyficationPass::lazifyCallsite(CallInst &CI, uint8_t index,
   return true;
 }
 
+/// Moves every candidate in @param schedule before the candidates whose calls
+/// its lazified argument is computed from, in @param candidates. Lazifying
+/// such an inner call site first would hand a thunk to its call, which the
+/// slice of the outer candidate cannot follow, so the outer candidate would
+/// be lost even if it is more beneficial. Otherwise, the order of
+/// @param schedule is kept.
+static void scheduleOuterCandidatesFirst(
+    ArrayRef<std::pair<CallInst *, uint8_t>> candidates,
+    SmallVectorImpl<unsigned> &schedule) {
+  std::map<CallInst *, SmallVector<unsigned>> candidatesOfCall;
+  for (unsigned idx = 0; idx < candidates.size(); ++idx) {
+    candidatesOfCall[candidates[idx].first].push_back(idx);
+  }
+
+  // outer[B] holds the candidates whose argument is computed from the call of
+  // candidate B
+  std::map<unsigned, SmallVector<unsigned>> outer;
+  for (unsigned idx = 0; idx < candidates.size(); ++idx) {
+    auto &[CI, argIdx] = candidates[idx];
+    Instruction *arg = dyn_cast<Instruction>(CI->getArgOperand(argIdx));
+    SmallPtrSet<Instruction *, 16> visited;
+    SmallVector<Instruction *> worklist;
+    if (arg) {
+      worklist.push_back(arg);
+      visited.insert(arg);
+    }
+    while (!worklist.empty()) {
+      Instruction *I = worklist.pop_back_val();
+      if (CallInst *inner = dyn_cast<CallInst>(I)) {
+        auto it = candidatesOfCall.find(inner);
+        if (it != candidatesOfCall.end()) {
+          for (unsigned innerIdx : it->second) {
+            outer[innerIdx].push_back(idx);
+          }
+        }
+      }
+      for (Value *op : I->operands()) {
+        Instruction *opI = dyn_cast<Instruction>(op);
+        if (opI && visited.insert(opI).second) {
+          worklist.push_back(opI);
+        }
+      }
+    }
+  }
+  if (outer.empty()) {
+    return;
+  }
+
+  SmallVector<unsigned> position(candidates.size());
+  for (unsigned i = 0; i < schedule.size(); ++i) {
+    position[schedule[i]] = i;
+  }
+  SmallVector<unsigned> ordered;
+  SmallVector<bool> emitted(candidates.size(), false);
+  std::function<void(unsigned)> emit = [&](unsigned idx) {
+    if (emitted[idx]) {
+      return;
+    }
+    emitted[idx] = true;
+    SmallVector<unsigned> &before = outer[idx];
+    llvm::sort(before, [&position](unsigned A, unsigned B) {
+      return position[A] < position[B];
+    });
+    for (unsigned outerIdx : before) {
+      emit(outerIdx);
+    }
+    ordered.push_back(idx);
+  };
+  for (unsigned idx : schedule) {
+    emit(idx);
+  }
+  schedule.assign(ordered.begin(), ordered.end());
+}
+
+/// Returns whether callee clone @param F is no longer called from outside of
+/// itself, so that it is swept when lazification finishes.
+static bool isUnusedClone(Function *F) {
+  return all_of(F->users(), [F](User *U) {
+    Instruction *I = dyn_cast<Instruction>(U);
+    return I && I->getFunction() == F;
+  });
+}
+
 bool WyvernLazyficationPass::runOnModule(Module &M) {
   SmallestSliceSize = std::numeric_limits<unsigned int>::max();
   FindLazyfiableAnalysis &FLA = getAnalysis<FindLazyfiableAnalysis>();
@@ -515,48 +2215,207 @@ bool WyvernLazyficationPass::runOnModule(Module &M) {
   }
 
   bool changed = false;
+
+  SmallPtrSet<Function *, 32> originalFunctions;
+  for (Function &F : M) {
+    originalFunctions.insert(&F);
+  }
+
+  // Emit lazy entry points for the annotated parameters of functions that
+  // may be called from other translation units
+  for (auto &[F, argIdx] : FLA.getLazyAnnotatedArgs()) {
+    if (F->isDeclaration() || F->hasLocalLinkage() || F->isVarArg() ||
+        M.getFunction(getLazyEntryName(*F, argIdx))) {
+      continue;
+    }
+    createLazyEntryPoint(*F, argIdx, memoFunctions, M);
+    changed = true;
+  }
+
   if (WyvernEnablePGO) {
     if (!loadProfileInfo(M, WyvernPGOFilePath)) {
       errs() << "Failed to load profile info for PGO! Exiting...\n";
       return false;
     }
 
-    for (Function &F : M) {
-      for (inst_iterator I = inst_begin(F); I != inst_end(F); ++I) {
-        if (!isa<CallInst>(&*I)) {
+    if (WyvernIndirectCallPromotion) {
+      changed |= promoteIndirectCalls(M);
+    }
+  }
+
+  // Call sites are lazified in rounds. Each round collects the candidates of
+  // the functions not visited yet, in the order of the module, so that they are
+  // lazified in the same order in every run, and then schedules them by
+  // benefit. Functions created while lazifying, such as callee clones, are
+  // visited in the next round. Each lazification rewrites its caller, so call
+  // sites are sliced and rewritten one at a time, on the analyses cached in the
+  // slicing context of their caller.
+  const std::set<std::pair<CallInst *, int>> &lazyfiable =
+      FLA.getLazyfiableCallSites();
+  auto start = std::chrono::steady_clock::now();
+  uint64_t moduleSize = 0;
+  int64_t growth = 0;
+  for (Function &F : M) {
+    moduleSize += getNumberOfInsts(F);
+  }
+  const char *exhaustedBudget = nullptr;
+  unsigned skipped = 0;
+  // Clones left unused by later lazifications of their call sites, whose
+  // size no longer counts against the budget unless they are reused
+  SmallPtrSet<Function *, 8> unusedClones;
+  Module::iterator next = M.begin();
+  while (next != M.end()) {
+    SmallVector<std::pair<CallInst *, uint8_t>> candidates;
+    Function *last = &M.getFunctionList().back();
+    for (Function &F : make_range(next, M.end())) {
+      for (Instruction &I : instructions(F)) {
+        CallInst *CI = dyn_cast<CallInst>(&I);
+        if (!CI) {
           continue;
         }
-        CallInst *CI = cast<CallInst>(&*I);
+        Function *callee = getOriginalCallee(CI->getCalledFunction());
         for (uint8_t argIdx = 0; argIdx < CI->arg_size(); ++argIdx) {
-          if (shouldLazifyCallsitePGO(CI, argIdx)) {
-            AAResults *AA =
-                &getAnalysis<AAResultsWrapperPass>(F).getAAResults();
-            changed = lazifyCallsite(*CI, argIdx, M, AA);
-            if (changed) {
-              break;
-            }
+          bool lazify = WyvernEnablePGO
+                            ? shouldLazifyCallsitePGO(CI, argIdx)
+                            : lazyfiable.count({CI, argIdx}) > 0 &&
+                                  FLA.isPromisingFunctionArg(callee, argIdx);
+          if (lazify) {
+            candidates.push_back({CI, argIdx});
           }
         }
       }
     }
-  }
+    next = std::next(last->getIterator());
 
-  else {
-    for (auto &pair : FLA.getLazyfiableCallSites()) {
-      CallInst *CI = pair.first;
-      uint8_t argIdx = pair.second;
-      Function *caller = CI->getParent()->getParent();
-      Function *callee = pair.first->getCalledFunction();
+    // Candidates are lazified from the most to the least beneficial, so that
+    // the budgets are spent on the hottest ones. Ties keep the module order.
+    SmallVector<double> benefits;
+    for (auto &[CI, argIdx] : candidates) {
+      benefits.push_back(getLazificationBenefit(*CI, argIdx));
+    }
+    SmallVector<unsigned> schedule(candidates.size());
+    std::iota(schedule.begin(), schedule.end(), 0);
+    std::stable_sort(schedule.begin(), schedule.end(),
+                     [&benefits](unsigned A, unsigned B) {
+                       return benefits[A] > benefits[B];
+                     });
+    scheduleOuterCandidatesFirst(candidates, schedule);
+
+    for (unsigned idx : schedule) {
+      auto &[CI, argIdx] = candidates[idx];
+      // Lazifying an outer candidate copies the inner call into its delegate,
+      // which leaves the original call dead
+      if (isInstructionTriviallyDead(CI)) {
+        continue;
+      }
+      if (!exhaustedBudget) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        if (WyvernTimeBudget && elapsed.count() >= WyvernTimeBudget) {
+          exhaustedBudget = "compile-time";
+        } else if (WyvernGrowthBudget &&
+                   growth * 100 >= (int64_t)(moduleSize * WyvernGrowthBudget)) {
+          exhaustedBudget = "code-growth";
+        }
+      }
+      if (exhaustedBudget) {
+        Function *callee = CI->getCalledFunction();
+        errs() << "Skipping argument " << (unsigned)argIdx << " of call to "
+               << (callee ? callee->getName() : "<indirect>") << " in "
+               << CI->getFunction()->getName() << ", with benefit "
+               << benefits[idx] << ": the " << exhaustedBudget
+               << " budget ran out\n";
+        ++NumCandidatesSkipped;
+        ++skipped;
+        continue;
+      }
 
+      // Code growth is measured by the growth of the caller and the functions
+      // created for the callsite. The clone the call site called before is
+      // swept if nothing else calls it, and counts again if it is reused.
+      Function *lastFunction = &M.getFunctionList().back();
+      Function *caller = CI->getFunction();
+      Function *previousCallee = CI->getCalledFunction();
+      int64_t callerSize = getNumberOfInsts(*caller);
       AAResults *AA =
           &getAnalysis<AAResultsWrapperPass>(*caller).getAAResults();
-      if (FLA.getPromisingFunctionArgs().count(std::make_pair(callee, argIdx)) >
-          0) {
-        changed = lazifyCallsite(*CI, argIdx, M, AA);
+      changed |= lazifyCallsite(*CI, argIdx, M, AA);
+      growth += (int64_t)getNumberOfInsts(*caller) - callerSize;
+      for (Function &F :
+           make_range(std::next(lastFunction->getIterator()), M.end())) {
+        growth += getNumberOfInsts(F);
+      }
+      Function *newCallee = CI->getCalledFunction();
+      if (newCallee != previousCallee) {
+        if (unusedClones.erase(newCallee)) {
+          growth += getNumberOfInsts(*newCallee);
+        }
+        if (previousCallee && cloneOrigins.count(previousCallee) &&
+            isUnusedClone(previousCallee) &&
+            unusedClones.insert(previousCallee).second) {
+          growth -= getNumberOfInsts(*previousCallee);
+        }
+      }
+    }
+  }
+
+  if (skipped) {
+    errs() << "Skipped " << skipped << " lazification candidates because the "
+           << exhaustedBudget << " budget ran out, after growing the module by "
+           << growth << " instructions\n";
+  }
+
+  slicingContexts.clear();
+
+  // Lazifying several arguments of a call site leaves behind the clones that
+  // only received some of its thunks. Erasing a clone may leave the clones it
+  // calls unused, so clones are visited again until nothing else is erased.
+  for (bool erased = true; erased;) {
+    erased = false;
+    for (auto &entry : clonedCallees) {
+      Function *clone = entry.second;
+      if (clone && isUnusedClone(clone)) {
+        cloneThunkArgs.erase(clone);
+        cloneOrigins.erase(clone);
+        for (auto it = thunkDelegates.begin(); it != thunkDelegates.end();) {
+          if (cast<Instruction>(it->first)->getFunction() == clone) {
+            it = thunkDelegates.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        clone->dropAllReferences();
+        clone->eraseFromParent();
+        entry.second = nullptr;
+        erased = true;
       }
     }
   }
 
+  // Delegates are folded first, so that clones called with the thunks of
+  // several equivalent delegates can still call the kept one directly
+  changed |= foldEquivalentFunctions(M, originalFunctions);
+  changed |= devirtualizeThunkCalls(M);
+
+  // Thunks are evaluated idempotently, so evaluations dominated by another
+  // evaluation of the same thunk are redundant
+  std::set<Function *> thunkUsers;
+  for (auto &entry : cloneThunkArgs) {
+    thunkUsers.insert(entry.first);
+  }
+  for (auto &entry : thunkDelegates) {
+    thunkUsers.insert(cast<Instruction>(entry.first)->getFunction());
+  }
+  for (Function *F : thunkUsers) {
+    changed |= mergeThunkEvaluations(*F);
+  }
+
+  nameGeneratedFunctions(M, originalFunctions);
+
+  if (WyvernCodeSizeReport) {
+    printCodeSizeReport(M, originalFunctions, moduleSize);
+  }
+
   if (SmallestSliceSize == std::numeric_limits<unsigned int>::max()) {
     SmallestSliceSize = 0;
   }
@@ -1,15 +1,29 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 
+#include <map>
+#include <memory>
 #include <set>
+#include <string>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace llvm {
 
+class Loop;
+class LoopInfo;
+class ProgramSlice;
+class SlicingContext;
+
 /// Struct that represents a given instance of profiling information. For each
 /// call site, the profile info gives us the number of times the call site was
 /// called, the number of times each argument was uniquely evaluated at least
-/// once per call, and the total number of evaluations for each argument.
+/// once per call, and the total number of evaluations for each argument. For
+/// indirect call sites, it also gives the number of times each target function
+/// was reached.
 struct WyvernCallSiteProfInfo {
   WyvernCallSiteProfInfo(uint8_t numArgs, uint64_t numCalls) {
     _uniqueEvals = SmallVector<int64_t>(numArgs);
@@ -20,6 +34,7 @@ struct WyvernCallSiteProfInfo {
   uint64_t _numCalls;
   SmallVector<int64_t> _uniqueEvals;
   SmallVector<int64_t> _totalEvals;
+  std::vector<std::pair<std::string, uint64_t>> _targets;
 };
 
 struct WyvernLazyficationPass : public ModulePass {
@@ -32,6 +47,66 @@ struct WyvernLazyficationPass : public ModulePass {
   /// generated through program slicing.
   bool lazifyCallsite(CallInst &CI, uint8_t index, Module &M, AAResults *AA);
 
+  /// Returns the clone of @param Callee whose formal parameter of index
+  /// @param index is a thunk of type @param thunkStructType, passed as a
+  /// @param thunkArgType, creating and caching it if necessary.
+  Function *getOrCloneCallee(Function &Callee, unsigned index,
+                             Type *thunkArgType, StructType *thunkStructType,
+                             Module &M);
+
+  /// Returns whether use @param U of a thunk passes it on to a promising
+  /// parameter of another function, whose index is stored in @param argNo.
+  bool isForwardableUse(Use &U, unsigned &argNo);
+
+  /// Forwards thunk @param thunkArg, a parameter of callee clone @param F, to
+  /// the calls in @param F that pass it on to a promising parameter of another
+  /// function. These calls are redirected to clones that receive the thunk
+  /// itself, so that it is not evaluated at the call. The operands that now
+  /// pass the thunk on are added to @param forwardedUses.
+  void forwardThunkArg(Function *F, Argument *thunkArg,
+                       StructType *thunkStructType,
+                       SmallPtrSetImpl<Use *> &forwardedUses, Module &M);
+
+  /// Returns whether the thunk that lazifies the actual parameter of index
+  /// @param index of call @param CI should be memoized (call-by-need), rather
+  /// than evaluated on every use (call-by-name). Thunks are memoized if they
+  /// may be evaluated more than once per call, according to the profile, or
+  /// to the uses of the parameter in the callee if there is no profile or the
+  /// callee may forward the thunk to another clone.
+  bool shouldMemoize(CallInst &CI, unsigned index);
+
+  /// Returns the outermost loop out of which the initialization of a thunk,
+  /// placed at @param initPoint, can be hoisted: the loop must have a
+  /// preheader and the thunk @param environment must be invariant in it.
+  /// Returns nullptr if the thunk must be initialized in every iteration.
+  Loop *getThunkHoistingLoop(Instruction &initPoint,
+                             ArrayRef<Value *> environment, LoopInfo &LI);
+
+  /// Returns whether the thunk that lazifies the actual parameter of index
+  /// @param index of call @param CI, whose environment is @param environment,
+  /// can be passed to a clone in registers: the environment is small and only
+  /// holds scalars, the thunk is not used anywhere else, and the callee is
+  /// small enough to be cloned for the types of the environment.
+  bool canPassEnvironmentInRegisters(CallInst &CI, unsigned index,
+                                     ArrayRef<Value *> environment);
+
+  /// Returns a clone of @param Callee that receives, for its parameter of
+  /// index @param index, a value of type @param envType: the delegate of the
+  /// thunk followed by its environment. The clone evaluates the thunk by
+  /// calling the delegate on the environment, with no thunk in memory. Clones
+  /// are cached by environment type, so call sites with different delegates
+  /// share one. With -wylazy-forward-thunks, the clone passes the environment
+  /// on to clones of the callees it forwards the parameter to.
+  Function *cloneCalleeWithEnvironment(Function &Callee, unsigned index,
+                                       StructType *envType, Module &M);
+
+  /// Returns the expected benefit of lazifying the actual parameter of index
+  /// @param index of call @param CI, used to schedule lazification: the
+  /// number of calls that do not evaluate the parameter, according to the
+  /// profile, or else the estimated frequency of the call site relative to
+  /// the entry of its caller.
+  double getLazificationBenefit(CallInst &CI, uint8_t index);
+
   /// Returns whether a call site + param pair should be lazified, taking into
   /// account the input profiling information.
   bool shouldLazifyCallsitePGO(CallInst *CI, uint8_t argIdx);
@@ -39,6 +114,68 @@ struct WyvernLazyficationPass : public ModulePass {
   /// Loads profile information from the input profiling report file.
   bool loadProfileInfo(Module &M, std::string path);
 
+  /// Promotes indirect call sites whose profile shows a dominant target into
+  /// guarded direct calls, so that their arguments can be lazified on the
+  /// promoted path. Returns whether any call site was promoted.
+  bool promoteIndirectCalls(Module &M);
+
+  /// Replaces the indirect calls through the thunk parameters of callee
+  /// clones by direct calls to their delegate functions, when every thunk
+  /// that may reach the parameter has the same delegate. For shared clones,
+  /// the hottest delegate is promoted to a guarded direct call, according to
+  /// the profile. Clones that receive environments in registers call the
+  /// delegate directly if all their call sites pass the same one. Returns
+  /// whether any call was devirtualized.
+  bool devirtualizeThunkCalls(Module &M);
+
+  /// Replaces the evaluations of thunks in @param F that are dominated by an
+  /// evaluation of the same thunk by the value of the latter. Memoized
+  /// evaluations, which check the memoization flag inline, are merged as a
+  /// whole, and those that no other evaluation may precede lose the weights
+  /// that favor the memoized value. Returns whether any evaluation was
+  /// replaced.
+  bool mergeThunkEvaluations(Function &F);
+
+  /// Folds the delegates and callee clones created by the pass, which are not
+  /// in @param originals, into structurally equivalent ones. Equivalent
+  /// functions may differ in the thunk struct types they access, as long as
+  /// these have the same layout. Returns whether any function was folded.
+  bool foldEquivalentFunctions(Module &M,
+                               const SmallPtrSetImpl<Function *> &originals);
+
+  /// Prints the number of instructions of module @param M, which had
+  /// @param originalSize instructions before lazification, and of the
+  /// delegates and callee clones added to it, which are not in
+  /// @param originals.
+  void printCodeSizeReport(Module &M,
+                           const SmallPtrSetImpl<Function *> &originals,
+                           uint64_t originalSize);
+
+  /// Number of delegates and callee clones folded into equivalent ones, and of
+  /// instructions removed by folding them, for the code size report.
+  unsigned numDelegatesFolded = 0;
+  unsigned numClonesFolded = 0;
+  uint64_t numInstsFolded = 0;
+
+  /// Gives the delegates and callee clones created by the pass, which are not
+  /// in @param originals, names derived from their contents, so that builds
+  /// are reproducible. Functions that only reference symbols that are shared
+  /// across translation units get linkonce_odr linkage (in a COMDAT, where
+  /// supported), so that identical copies created in different translation
+  /// units are merged at link time. The others remain internal.
+  void nameGeneratedFunctions(Module &M,
+                              const SmallPtrSetImpl<Function *> &originals);
+
+  /// Returns the slicing context of @param F, creating and caching it if
+  /// necessary, so that all the call sites of a function are sliced using the
+  /// same control-flow analyses.
+  SlicingContext &getSlicingContext(Function &F);
+
+  /// Caches the slicing context of every function whose call sites were
+  /// sliced. Contexts are only valid while lazifying call sites, since the
+  /// later transformations may change the control flow of their functions.
+  std::map<Function *, std::unique_ptr<SlicingContext>> slicingContexts;
+
   /// Stores the set of callee function + argument pairs that were lazified.
   std::set<std::pair<Function *, Instruction *>> lazifiedFunctions;
 
@@ -47,9 +184,44 @@ struct WyvernLazyficationPass : public ModulePass {
       profileInfo;
 
   /// Caches the previously cloned callee functions, to be reused if possible.
-  std::map<std::tuple<Function *, unsigned, StructType *>, Function *>
+  /// Clones are keyed by the thunk header type they access, which is uniqued
+  /// by the type of the lazified value, or by the type of the environment they
+  /// receive in registers. Clones for variadic arguments are also keyed by
+  /// their own type, which fixes the types of the variadic arguments; the
+  /// type is null for other clones.
+  std::map<std::tuple<Function *, unsigned, StructType *, FunctionType *>,
+           Function *>
       clonedCallees;
 
+  /// Maps every callee clone (and lazy wrapper) to the original function it was
+  /// created from. Call sites may be lazified in terms of several arguments,
+  /// in which case they already call a clone when their next argument is
+  /// lazified.
+  std::map<Function *, Function *> cloneOrigins;
+
+  /// Returns the function that callee clone @param F was created from, or
+  /// @param F itself if it is not a clone.
+  Function *getOriginalCallee(Function *F) {
+    auto it = cloneOrigins.find(F);
+    return it == cloneOrigins.end() ? F : it->second;
+  }
+
+  /// Maps every callee clone to the indices of its thunk parameters.
+  std::map<Function *, SmallVector<unsigned>> cloneThunkArgs;
+
+  /// Maps the thunks allocated in callers to their delegate functions, and
+  /// each delegate function to the call site it was created for.
+  std::map<Value *, Function *> thunkDelegates;
+  std::map<Function *, CallInst *> delegateCallSites;
+
+  /// Caches the functions that evaluated memoized thunks point to, keyed by
+  /// the type of their value (see ProgramSlice::getMemoizedValueFunction).
+  DenseMap<Type *, Function *> memoFunctions;
+
+  /// Caches the wrappers created for functions with no body, whose parameters
+  /// were annotated as lazy, keyed by (callee, index).
+  std::map<std::pair<Function *, unsigned>, Function *> lazyWrappers;
+
   bool runOnModule(Module &);
   void getAnalysisUsage(AnalysisUsage &) const;
 };
@@ -2,17 +2,18 @@
 #include "DebugUtils.h"
 
 #include <map>
-#include <queue>
 #include <set>
 #include <stack>
 #include <tuple>
-#include <unordered_map>
 #include <utility>
 
 #include "llvm/ADT/Statistic.h"
-#include "llvm/Analysis/AliasSetTracker.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Analysis/CFG.h"
 #include "llvm/Analysis/CaptureTracking.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemorySSA.h"
 #include "llvm/Analysis/MemoryLocation.h"
 #include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
@@ -29,152 +30,531 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
-#include <random>
 
 #define DEBUG_TYPE "ProgramSlicing"
 
 using namespace llvm;
 
-/// Returns the block whose predicate should control the phi-functions in BB
-static const BasicBlock *getController(const BasicBlock *BB, DominatorTree &DT,
-                                       PostDominatorTree &PDT) {
-  const DomTreeNode *dom_node = DT.getNode(BB);
-  while (dom_node) {
-    const BasicBlock *dom_BB = dom_node->getBlock();
-    if (!PDT.dominates(BB, dom_BB)) {
-      return dom_BB;
-    } else {
-      dom_node = dom_node->getIDom();
-    }
-  }
-  return NULL;
-}
-
-/// Returns the predicate of the given basic block, which will be used to gate
-/// another basic block's phi-functions.
-static const Value *getGate(const BasicBlock *BB) {
-  const Value *condition;
-
-  const Instruction *terminator = BB->getTerminator();
-  if (const BranchInst *BI = dyn_cast<BranchInst>(terminator)) {
-    assert(BI->isConditional() && "Inconditional terminator!");
-    condition = BI;
-  }
-
-  else if (const SwitchInst *SI = dyn_cast<SwitchInst>(terminator)) {
-    condition = SI;
-  }
-
-  return condition;
-}
-
-/// Computes the gates for all basic blocks in the slice. The data structure
-/// holding the gates data is a map of each basic block to a vector of its
-/// gates.
-static const std::unordered_map<const BasicBlock *, SmallVector<const Value *>>
-computeGates(Function &F) {
-  std::unordered_map<const BasicBlock *, SmallVector<const Value *>> gates;
-  DominatorTree DT(F);
-  PostDominatorTree PDT;
-  PDT.recalculate(F);
-  for (const BasicBlock &BB : F) {
-    SmallVector<const Value *> BB_gates;
-    const unsigned num_preds = pred_size(&BB);
-    if (num_preds > 1) {
-      LLVM_DEBUG(dbgs() << BB.getName() << ":\n");
-      for (const BasicBlock *pred : predecessors(&BB)) {
-        LLVM_DEBUG(dbgs() << " - " << pred->getName() << " -> ");
-        if (DT.dominates(pred, &BB) && !PDT.dominates(&BB, pred)) {
-          LLVM_DEBUG(dbgs() << " DOM " << getGate(pred)->getName() << " -> ");
-          BB_gates.push_back(getGate(pred));
-        } else {
-          const BasicBlock *ctrl_BB = getController(pred, DT, PDT);
-          if (ctrl_BB) {
-            LLVM_DEBUG(dbgs() << " R-CTRL "
-                              << "CTRL_BB: " << ctrl_BB->getName() << " "
-                              << getGate(ctrl_BB)->getName());
-            BB_gates.push_back(getGate(ctrl_BB));
-          }
-        }
-        LLVM_DEBUG(dbgs() << ";\n");
-      }
+/// Computes the backwards data dependences for the given instructions, to
+/// compute which instructions should be part of the slice. Using the
+/// phi-function gate information contained in context, control dependencies can
+/// also be tracked as data dependences. Thus, this function is enough to
+/// compute all dependencies necessary to building a slice. The dependences of
+/// the values in captured are not tracked, since these values are taken from
+/// the thunk environment rather than recomputed.
+///
+/// Slices of the same function overlap, so the full closures, computed with
+/// no captured values, are memoized in context for every root. Traversals
+/// stop at values whose closure is already known, and take it as a whole.
+/// Traversals with captured values only take the closures that contain none
+/// of them, which they would have computed the same way.
+static std::tuple<BitVector, BitVector>
+get_data_dependences_for(ArrayRef<Instruction *> roots,
+                         SlicingContext &context,
+                         const SmallPtrSetImpl<const Value *> &captured) {
+  bool memoize = captured.empty();
+  BitVector capturedValues(context.getNumValues());
+  for (const Value *V : captured) {
+    unsigned number = context.getNumber(V);
+    if (number >= capturedValues.size()) {
+      capturedValues.resize(number + 1);
+    }
+    capturedValues.set(number);
+  }
+  if (memoize && roots.size() > 1) {
+    BitVector deps(context.getNumValues());
+    BitVector BBs(context.getNumBlocks());
+    for (Instruction *I : roots) {
+      auto [rootBBs, rootDeps] = get_data_dependences_for(I, context, captured);
+      deps |= rootDeps;
+      BBs |= rootBBs;
+    }
+    deps.resize(context.getNumValues());
+    return std::make_tuple(BBs, deps);
+  }
+  if (memoize) {
+    if (const SlicingContext::Closure *closure =
+            context.getClosure(roots.front())) {
+      BitVector deps = closure->values;
+      deps.resize(context.getNumValues());
+      return std::make_tuple(closure->blocks, deps);
     }
-    gates.emplace(std::make_pair(&BB, BB_gates));
   }
-  return gates;
-}
 
-/// Computes the backwards data dependences for the given instruction, to
-/// compute which instructions should be part of the slice. Using the
-/// phi-function gate information contained in gates, control dependencies can
-/// also be tracked as data dependences. Thus, this function is enough to
-/// compute all dependencies necessary to building a slice.
-static std::tuple<std::set<const BasicBlock *>, std::set<const Value *>>
-get_data_dependences_for(
-    Instruction &I,
-    std::unordered_map<const BasicBlock *, SmallVector<const Value *>> &gates) {
-  std::set<const Value *> deps;
-  std::set<const BasicBlock *> BBs;
-  std::set<const Value *> visited;
-  std::queue<const Value *> to_visit;
-
-  to_visit.push(&I);
-  deps.insert(&I);
+  BitVector deps(context.getNumValues());
+  BitVector BBs(context.getNumBlocks());
+  SmallVector<const Value *, 32> to_visit;
+
+  auto visit = [&](const Value *V) {
+    unsigned number = context.getNumber(V);
+    if (number >= deps.size()) {
+      deps.resize(number + 1);
+    }
+    if (deps.test(number)) {
+      return;
+    }
+    const SlicingContext::Closure *closure = context.getClosure(V);
+    if (closure && (memoize || !closure->values.anyCommon(capturedValues))) {
+      deps |= closure->values;
+      BBs |= closure->blocks;
+    } else {
+      deps.set(number);
+      to_visit.push_back(V);
+    }
+  };
+
+  for (Instruction *I : roots) {
+    visit(I);
+  }
   while (!to_visit.empty()) {
-    const Value *cur = to_visit.front();
-    deps.insert(cur);
-    to_visit.pop();
+    const Value *cur = to_visit.pop_back_val();
+
+    if (captured.count(cur)) {
+      continue;
+    }
 
     if (const Instruction *dep = dyn_cast<Instruction>(cur)) {
-      BBs.insert(dep->getParent());
+      BBs.set(context.getBlockNumber(dep->getParent()));
       for (const Use &U : dep->operands()) {
-        if ((!isa<Instruction>(U) && !isa<Argument>(U)) || visited.count(U)) {
-          continue;
+        if (isa<Instruction>(U) || isa<Argument>(U)) {
+          visit(U);
         }
-        visited.insert(U);
-        to_visit.push(U);
       }
     }
 
     if (const PHINode *PN = dyn_cast<PHINode>(cur)) {
       for (const BasicBlock *BB : PN->blocks()) {
-        BBs.insert(BB);
+        BBs.set(context.getBlockNumber(BB));
       }
-      for (const Value *gate : gates[PN->getParent()]) {
-        if (gate && !visited.count(gate)) {
-          to_visit.push(gate);
+      for (const Value *gate : context.getGates(PN->getParent())) {
+        if (gate) {
+          visit(gate);
         }
       }
     }
   }
 
+  deps.resize(context.getNumValues());
+  if (memoize) {
+    context.setClosure(roots.front(), {deps, BBs});
+  }
   return std::make_tuple(BBs, deps);
 }
 
-ProgramSlice::ProgramSlice(Instruction &Initial, Function &F,
+/// Returns the instructions in the backward slice valuesInSlice of Initial that
+/// should be captured in the thunk environment, rather than recomputed by the
+/// delegate: values that F computes anyway, because they have uses outside of
+/// the slice, and values carried across iterations of the loops around
+/// CallSite, which the delegate could not recompute. Only values available
+/// where the thunk is initialized, right before Initial, can be captured.
+static SmallPtrSet<const Value *, 8>
+computeCapturedValues(Instruction &Initial, SlicingContext &context,
+                      CallInst &CallSite, const BitVector &valuesInSlice) {
+  DominatorTree &DT = context.getDomTree();
+  LoopInfo &LI = context.getLoopInfo();
+  const Instruction *initPoint = &Initial;
+  if (isa<PHINode>(Initial)) {
+    initPoint = &*Initial.getParent()->getFirstInsertionPt();
+  }
+
+  SmallPtrSet<const Value *, 8> captured;
+  for (unsigned number : valuesInSlice.set_bits()) {
+    const Instruction *I = dyn_cast<Instruction>(context.getValue(number));
+    if (!I || I == &Initial || isa<AllocaInst>(I) ||
+        !DT.dominates(I, initPoint)) {
+      continue;
+    }
+
+    const Loop *L = LI.getLoopFor(I->getParent());
+    bool carriedAcrossCalls = isa<PHINode>(I) && L &&
+                              L->getHeader() == I->getParent() &&
+                              L->contains(CallSite.getParent());
+    bool usedOutsideSlice = any_of(I->users(), [&](const User *U) {
+      return !isa<DbgInfoIntrinsic>(U) && !context.contains(valuesInSlice, U);
+    });
+    if (carriedAcrossCalls || usedOutsideSlice) {
+      captured.insert(I);
+    }
+  }
+  return captured;
+}
+
+/// Returns whether @param CB is a call to a library function that builds a
+/// string in the buffer pointed to by its first argument, and writes to no
+/// other memory.
+static bool isStringBuildingCall(const CallBase &CB, TargetLibraryInfo &TLI) {
+  LibFunc builtin;
+  if (!CB.getCalledFunction() || !TLI.getLibFunc(*CB.getCalledFunction(),
+                                                 builtin)) {
+    return false;
+  }
+  switch (builtin) {
+  case LibFunc_sprintf:
+  case LibFunc_snprintf:
+  case LibFunc_strcpy:
+  case LibFunc_strncpy:
+  case LibFunc_strcat:
+  case LibFunc_strncat:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Returns whether @param F is a library function whose only side effect is
+/// setting errno, such as most of libm when math-errno is enabled.
+static bool isErrnoOnlyLibFunc(const Function &F, TargetLibraryInfo &TLI) {
+  LibFunc builtin;
+  if (!TLI.getLibFunc(F, builtin)) {
+    return false;
+  }
+  switch (builtin) {
+  case LibFunc_acos:
+  case LibFunc_acosf:
+  case LibFunc_acosl:
+  case LibFunc_acosh:
+  case LibFunc_acoshf:
+  case LibFunc_acoshl:
+  case LibFunc_asin:
+  case LibFunc_asinf:
+  case LibFunc_asinl:
+  case LibFunc_asinh:
+  case LibFunc_asinhf:
+  case LibFunc_asinhl:
+  case LibFunc_atan:
+  case LibFunc_atanf:
+  case LibFunc_atanl:
+  case LibFunc_atan2:
+  case LibFunc_atan2f:
+  case LibFunc_atan2l:
+  case LibFunc_atanh:
+  case LibFunc_atanhf:
+  case LibFunc_atanhl:
+  case LibFunc_cos:
+  case LibFunc_cosf:
+  case LibFunc_cosl:
+  case LibFunc_cosh:
+  case LibFunc_coshf:
+  case LibFunc_coshl:
+  case LibFunc_exp:
+  case LibFunc_expf:
+  case LibFunc_expl:
+  case LibFunc_exp10:
+  case LibFunc_exp10f:
+  case LibFunc_exp10l:
+  case LibFunc_exp2:
+  case LibFunc_exp2f:
+  case LibFunc_exp2l:
+  case LibFunc_expm1:
+  case LibFunc_expm1f:
+  case LibFunc_expm1l:
+  case LibFunc_fmod:
+  case LibFunc_fmodf:
+  case LibFunc_fmodl:
+  case LibFunc_ldexp:
+  case LibFunc_ldexpf:
+  case LibFunc_ldexpl:
+  case LibFunc_log:
+  case LibFunc_logf:
+  case LibFunc_logl:
+  case LibFunc_log10:
+  case LibFunc_log10f:
+  case LibFunc_log10l:
+  case LibFunc_log1p:
+  case LibFunc_log1pf:
+  case LibFunc_log1pl:
+  case LibFunc_log2:
+  case LibFunc_log2f:
+  case LibFunc_log2l:
+  case LibFunc_logb:
+  case LibFunc_logbf:
+  case LibFunc_logbl:
+  case LibFunc_pow:
+  case LibFunc_powf:
+  case LibFunc_powl:
+  case LibFunc_remainder:
+  case LibFunc_remainderf:
+  case LibFunc_remainderl:
+  case LibFunc_sin:
+  case LibFunc_sinf:
+  case LibFunc_sinl:
+  case LibFunc_sinh:
+  case LibFunc_sinhf:
+  case LibFunc_sinhl:
+  case LibFunc_sqrt:
+  case LibFunc_sqrtf:
+  case LibFunc_sqrtl:
+  case LibFunc_tan:
+  case LibFunc_tanf:
+  case LibFunc_tanl:
+  case LibFunc_tanh:
+  case LibFunc_tanhf:
+  case LibFunc_tanhl:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Returns whether @param F returns the address of errno.
+static bool isErrnoAccessor(const Function &F) {
+  return F.getName() == "__errno_location" || F.getName() == "__error" ||
+         F.getName() == "_errno" || F.getName() == "___errno";
+}
+
+/// Returns whether @param F is a library function that prints errno, or the
+/// message that describes it.
+static bool isErrnoReader(const Function &F) {
+  return StringSwitch<bool>(F.getName())
+      .Cases("perror", "psignal", "syslog", "vsyslog", true)
+      .Cases("err", "verr", "warn", "vwarn", true)
+      .Cases("error", "error_at_line", true)
+      .Default(false);
+}
+
+/// Returns the index of the format string of @param F, if it is a library
+/// function of the printf family, whose %m conversion prints the message that
+/// describes errno.
+static Optional<unsigned> getPrintfFormatIndex(const Function &F,
+                                               TargetLibraryInfo &TLI) {
+  LibFunc builtin;
+  if (!TLI.getLibFunc(F, builtin)) {
+    return None;
+  }
+  switch (builtin) {
+  case LibFunc_printf:
+  case LibFunc_vprintf:
+    return 0;
+  case LibFunc_fprintf:
+  case LibFunc_vfprintf:
+  case LibFunc_sprintf:
+  case LibFunc_vsprintf:
+    return 1;
+  case LibFunc_snprintf:
+  case LibFunc_vsnprintf:
+    return 2;
+  default:
+    return None;
+  }
+}
+
+static bool mayReadErrno(const Function &F, TargetLibraryInfo &TLI,
+                         SmallPtrSetImpl<const Function *> &visited);
+
+/// Returns whether call @param CB may read errno. Calls to the printf family
+/// only do so if their format string is unknown or contains %m.
+static bool callMayReadErrno(const CallBase &CB, TargetLibraryInfo &TLI,
+                             SmallPtrSetImpl<const Function *> &visited) {
+  const Function *callee = CB.getCalledFunction();
+  if (!callee) {
+    return true;
+  }
+  if (Optional<unsigned> formatIdx = getPrintfFormatIndex(*callee, TLI)) {
+    StringRef format;
+    return *formatIdx >= CB.arg_size() ||
+           !getConstantStringInfo(CB.getArgOperand(*formatIdx), format) ||
+           format.contains("%m");
+  }
+  return mayReadErrno(*callee, TLI, visited);
+}
+
+/// Returns whether a call to @param F may read errno, either directly or
+/// through the functions it calls. Besides the functions that print errno,
+/// external functions that are not known library functions may read errno.
+static bool mayReadErrno(const Function &F, TargetLibraryInfo &TLI,
+                         SmallPtrSetImpl<const Function *> &visited) {
+  if (!visited.insert(&F).second || F.isIntrinsic() ||
+      ProgramSlice::isIdempotentDelegate(&F)) {
+    return false;
+  }
+  if (isErrnoAccessor(F) || isErrnoReader(F) ||
+      getPrintfFormatIndex(F, TLI)) {
+    return true;
+  }
+  LibFunc builtin;
+  if (F.isDeclaration()) {
+    return !TLI.getLibFunc(F, builtin);
+  }
+
+  for (const Instruction &I : instructions(F)) {
+    const CallBase *CB = dyn_cast<CallBase>(&I);
+    if (!CB) {
+      continue;
+    }
+    if (!CB->getCalledFunction()) {
+      // Thunks are evaluated by calling the function pointer in their first
+      // field, which is always a delegate
+      const LoadInst *fptr = dyn_cast<LoadInst>(CB->getCalledOperand());
+      if (CB->arg_size() == 1 && fptr &&
+          getUnderlyingObject(fptr->getPointerOperand()) ==
+              getUnderlyingObject(CB->getArgOperand(0))) {
+        continue;
+      }
+      return true;
+    }
+    if (callMayReadErrno(*CB, TLI, visited)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Returns the local buffer that @param Initial points into, if the buffer
+/// can be migrated into the delegate along with the instructions that
+/// initialize it, which are added to @param initializers. Only buffers whose
+/// address does not escape, and that are only read through the lazified
+/// argument of @param CallSite, can be migrated. Their initializers must be
+/// stores, memory intrinsics or string-building calls in the block of
+/// @param Initial, which cannot execute after the call, since the delegate
+/// returns at the end of that block.
+static AllocaInst *
+findMigratableBuffer(Instruction &Initial, CallInst &CallSite,
+                     TargetLibraryInfo &TLI,
+                     SmallVectorImpl<Instruction *> &initializers) {
+  AllocaInst *buffer = dyn_cast<AllocaInst>(getUnderlyingObject(&Initial));
+  if (!buffer || buffer == &Initial || !buffer->isStaticAlloca()) {
+    return nullptr;
+  }
+
+  SmallVector<Instruction *> inits;
+  SmallVector<const Value *> worklist = {buffer};
+  unsigned numCallSiteUses = 0;
+  while (!worklist.empty()) {
+    const Value *ptr = worklist.pop_back_val();
+    for (const Use &U : ptr->uses()) {
+      Instruction *user = cast<Instruction>(U.getUser());
+      if (user == &CallSite) {
+        if (ptr != &Initial) {
+          return nullptr;
+        }
+        ++numCallSiteUses;
+      } else if (isa<GetElementPtrInst>(user) || isa<BitCastInst>(user)) {
+        worklist.push_back(user);
+      } else if (user->isLifetimeStartOrEnd()) {
+        continue;
+      } else if (StoreInst *SI = dyn_cast<StoreInst>(user)) {
+        if (SI->getValueOperand() == ptr || SI->isVolatile()) {
+          return nullptr;
+        }
+        inits.push_back(SI);
+      } else if (MemIntrinsic *MI = dyn_cast<MemIntrinsic>(user)) {
+        if (MI->getRawDest() != ptr || MI->isVolatile() ||
+            (isa<MemTransferInst>(MI) &&
+             cast<MemTransferInst>(MI)->getRawSource() == ptr)) {
+          return nullptr;
+        }
+        inits.push_back(MI);
+      } else if (CallInst *CI = dyn_cast<CallInst>(user)) {
+        if (!isStringBuildingCall(*CI, TLI) || U.getOperandNo() != 0 ||
+            !CI->use_empty()) {
+          return nullptr;
+        }
+        inits.push_back(CI);
+      } else {
+        return nullptr;
+      }
+    }
+  }
+
+  if (numCallSiteUses != 1 || inits.empty()) {
+    return nullptr;
+  }
+  for (Instruction *init : inits) {
+    if (init->getParent() != Initial.getParent() ||
+        isPotentiallyReachable(&CallSite, init)) {
+      return nullptr;
+    }
+  }
+
+  initializers.append(inits.begin(), inits.end());
+  return buffer;
+}
+
+/// Adds to @param sources the memory locations read by @param Init, an
+/// initializer of migrated buffer @param Buffer, other than the buffer itself:
+/// the source of memory transfers, and the strings and arguments read by
+/// string-building calls.
+static void getInitializerSources(const Instruction &Init,
+                                  const AllocaInst &Buffer,
+                                  TargetLibraryInfo &TLI,
+                                  SmallVectorImpl<MemoryLocation> &sources) {
+  if (const MemTransferInst *MTI = dyn_cast<MemTransferInst>(&Init)) {
+    sources.push_back(MemoryLocation::getForSource(MTI));
+    return;
+  }
+
+  const CallBase *CB = dyn_cast<CallBase>(&Init);
+  if (!CB || isa<MemIntrinsic>(CB)) {
+    return;
+  }
+  for (unsigned i = 0; i < CB->arg_size(); ++i) {
+    const Value *arg = CB->getArgOperand(i);
+    if (arg->getType()->isPointerTy() && getUnderlyingObject(arg) != &Buffer) {
+      sources.push_back(MemoryLocation::getForArgument(CB, i, TLI));
+    }
+  }
+}
+
+ProgramSlice::ProgramSlice(Instruction &Initial, SlicingContext &context,
                            CallInst &CallSite, AAResults *AA,
                            TargetLibraryInfo &TLI, bool thunkDebugging)
-    : _AA(AA), _TLI(TLI), _initial(&Initial), _parentFunction(&F),
+    : _AA(AA), _TLI(TLI), _initial(&Initial),
+      _parentFunction(&context.getFunction()), _context(context),
       _thunkDebugging(thunkDebugging) {
+  Function &F = context.getFunction();
   assert(Initial.getParent()->getParent() == &F &&
          "Slicing instruction from different function!");
 
-  std::unordered_map<const BasicBlock *, SmallVector<const Value *>> gates =
-      computeGates(F);
-  auto [BBsInSlice, valuesInSlice] = get_data_dependences_for(Initial, gates);
-  std::set<const Instruction *> instsInSlice;
-  SmallVector<Argument *> depArgs;
-
-  for (auto &val : valuesInSlice) {
-    if (Argument *A = dyn_cast<Argument>(const_cast<Value *>(val))) {
-      depArgs.push_back(A);
-    } else if (const Instruction *I = dyn_cast<Instruction>(val)) {
-      instsInSlice.insert(I);
+  // Local buffers built right before being passed to the call are migrated to
+  // the delegate: their initializers are sliced along with the lazified
+  // pointer, and the buffer itself, which outlives the delegate, is captured
+  SmallVector<Instruction *> roots = {&Initial};
+  _migratedBuffer =
+      findMigratableBuffer(Initial, CallSite, TLI, _bufferInitializers);
+  append_range(roots, _bufferInitializers);
+
+  // The slice is cut at the values that are captured in the environment, so
+  // the delegate only recomputes what the parent function would not compute
+  // otherwise
+  auto [fullBBsInSlice, fullValuesInSlice] =
+      get_data_dependences_for(roots, context, SmallPtrSet<const Value *, 1>());
+  SmallPtrSet<const Value *, 8> captured =
+      computeCapturedValues(Initial, context, CallSite, fullValuesInSlice);
+  if (_migratedBuffer) {
+    captured.insert(_migratedBuffer);
+  }
+  auto [BBsInSlice, valuesInSlice] =
+      get_data_dependences_for(roots, context, captured);
+  BitVector instsInSlice(valuesInSlice.size());
+  SmallVector<Value *> environment;
+
+  for (unsigned number : valuesInSlice.set_bits()) {
+    const Value *val = context.getValue(number);
+    if (isa<Argument>(val) || captured.count(val)) {
+      environment.push_back(const_cast<Value *>(val));
+    } else if (isa<Instruction>(val)) {
+      instsInSlice.set(number);
     }
   }
 
+  // The environment is laid out in the thunk in order of decreasing size and
+  // alignment, which minimizes padding, breaking ties by argument number and
+  // then by the position of captured values in the function, so that the
+  // layout does not depend on the order of the values in memory
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  auto layoutKey = [&DL, &context](Value *V) {
+    return std::make_tuple(-(int64_t)DL.getTypeAllocSize(V->getType()),
+                           -(int64_t)DL.getABITypeAlign(V->getType()).value(),
+                           context.getNumber(V));
+  };
+  sort(environment, [&layoutKey](Value *A, Value *B) {
+    return layoutKey(A) < layoutKey(B);
+  });
+  environment.erase(std::unique(environment.begin(), environment.end()),
+                    environment.end());
+
   _instsInSlice = instsInSlice;
-  _depArgs = depArgs;
+  _environment = environment;
   _BBsInSlice = BBsInSlice;
   _CallSite = &CallSite;
 
@@ -190,7 +570,8 @@ ProgramSlice::ProgramSlice(Instruction &Initial, Function &F,
 }
 
 /// Computes the layout of the struct type that should be used to lazify
-/// instances of this delegate function.
+/// instances of this delegate function. The layout always starts with the
+/// fields of the thunk header returned by getThunkHeaderType.
 StructType *ProgramSlice::computeStructType(bool memo) {
   Module *M = _initial->getParent()->getParent()->getParent();
   LLVMContext &Ctx = M->getContext();
@@ -204,11 +585,11 @@ StructType *ProgramSlice::computeStructType(bool memo) {
     // Memoized thunks have the form:
     //   T (fptr)(struct thunk *thk);
     //   T memo_val;
-    //   bool memo_flag;
     //   ... (environment)
+    // Once evaluated, fptr points to the function returned by
+    // getMemoizedValueFunction, which also serves as the memoization flag.
     thunkTypes = {delegateFunctionType->getPointerTo(),
-                  delegateFunctionType->getReturnType(),
-                  IntegerType::get(Ctx, 1)};
+                  delegateFunctionType->getReturnType()};
   } else {
     // Non-memoized thunks have the form:
     //  T (fptr)(struct thunk *thk);
@@ -216,8 +597,8 @@ StructType *ProgramSlice::computeStructType(bool memo) {
     thunkTypes = {delegateFunctionType->getPointerTo()};
   }
 
-  for (auto &arg : _depArgs) {
-    thunkTypes.push_back(arg->getType());
+  for (Value *V : _environment) {
+    thunkTypes.push_back(V->getType());
   }
 
   thunkStructType->setBody(thunkTypes);
@@ -226,6 +607,64 @@ StructType *ProgramSlice::computeStructType(bool memo) {
   return thunkStructType;
 }
 
+FunctionType *
+ProgramSlice::getDelegateFunctionType(StructType *thunkStructType) {
+  return cast<FunctionType>(
+      thunkStructType->getElementType(0)->getPointerElementType());
+}
+
+StructType *ProgramSlice::getThunkHeaderType(Type *valueType, bool memo) {
+  LLVMContext &Ctx = valueType->getContext();
+  FunctionType *delegateFunctionType =
+      FunctionType::get(valueType, {Type::getInt8PtrTy(Ctx)}, false);
+  SmallVector<Type *> headerTypes = {delegateFunctionType->getPointerTo()};
+  if (memo) {
+    headerTypes.push_back(valueType);
+  }
+  return StructType::get(Ctx, headerTypes);
+}
+
+Function *
+ProgramSlice::getMemoizedValueFunction(Type *valueType, Module &M,
+                                       MemoizedValueFunctionMap &functions) {
+  Function *&F = functions[valueType];
+  if (F) {
+    return F;
+  }
+
+  std::string typeName;
+  raw_string_ostream rso(typeName);
+  valueType->print(rso);
+  for (char &c : typeName) {
+    if (!isAlnum(c)) {
+      c = '_';
+    }
+  }
+
+  StructType *thunkHeaderType = getThunkHeaderType(valueType, true);
+  FunctionType *FT = getDelegateFunctionType(thunkHeaderType);
+  F = Function::Create(FT, Function::InternalLinkage,
+                       "_wyvern_memo_ret_" + typeName, M);
+  F->arg_begin()->setName("_wyvern_thunkptr");
+  IRBuilder<> builder(BasicBlock::Create(M.getContext(), "entry", F));
+  Value *thunkPtr = builder.CreatePointerCast(
+      F->arg_begin(), thunkHeaderType->getPointerTo());
+  Value *memoedValueGEP = builder.CreateStructGEP(thunkHeaderType, thunkPtr, 1,
+                                                  "_wyvern_memo_val_addr");
+  builder.CreateRet(
+      builder.CreateLoad(valueType, memoedValueGEP, "_wyvern_memo_val"));
+
+  AttrBuilder attrs(M.getContext());
+  attrs.addAttribute(Attribute::ReadOnly);
+  attrs.addAttribute(Attribute::ArgMemOnly);
+  attrs.addAttribute(Attribute::NoUnwind);
+  attrs.addAttribute(Attribute::WillReturn);
+  F->addFnAttrs(attrs);
+  F->addParamAttr(0, Attribute::NoCapture);
+  F->setMetadata(IdempotentDelegateMD, MDNode::get(M.getContext(), {}));
+  return F;
+}
+
 StructType *ProgramSlice::getThunkStructType(bool memo) {
   if (memo) {
     return _memoizedThunkStructType;
@@ -241,17 +680,17 @@ void ProgramSlice::printSlice() {
                     << " ====\n");
   LLVM_DEBUG(dbgs() << "==== Call site: " << *_CallSite << " ====\n");
   LLVM_DEBUG(dbgs() << "BBs in slice:\n");
-  for (const BasicBlock *BB : _BBsInSlice) {
+  for (const BasicBlock *BB : getBBsInSlice()) {
     LLVM_DEBUG(dbgs() << "\t" << BB->getName() << "\n");
     for (const Instruction &I : *BB) {
-      if (_instsInSlice.count(&I)) {
+      if (isInSlice(&I)) {
         LLVM_DEBUG(dbgs() << "\t\t" << I << "\n";);
       }
     }
   }
-  LLVM_DEBUG(dbgs() << "Arguments in slice:\n");
-  for (const Argument *A : _depArgs) {
-    LLVM_DEBUG(dbgs() << "\t" << *A << "\n";);
+  LLVM_DEBUG(dbgs() << "Environment of slice:\n");
+  for (const Value *V : _environment) {
+    LLVM_DEBUG(dbgs() << "\t" << *V << "\n";);
   }
   LLVM_DEBUG(dbgs() << "============= \n\n");
 }
@@ -267,16 +706,15 @@ void ProgramSlice::printFunctions(Function *F) {
 /// original function. The map of basic blocks to their attractors is used to
 /// reroute control flow in the outlined delegate function.
 void ProgramSlice::computeAttractorBlocks() {
-  PostDominatorTree PDT;
-  PDT.recalculate(*_parentFunction);
-  std::map<const BasicBlock *, const BasicBlock *> attractors;
+  PostDominatorTree &PDT = _context.getPostDomTree();
+  DenseMap<const BasicBlock *, const BasicBlock *> attractors;
 
   for (const BasicBlock &BB : *_parentFunction) {
     if (attractors.count(&BB) > 0) {
       continue;
     }
 
-    if (_BBsInSlice.count(&BB) > 0) {
+    if (isInSlice(&BB)) {
       attractors[&BB] = &BB;
       continue;
     }
@@ -284,7 +722,7 @@ void ProgramSlice::computeAttractorBlocks() {
     DomTreeNode *OrigBB = PDT.getNode(&BB);
     DomTreeNode *Cand = OrigBB->getIDom();
     while (Cand != nullptr) {
-      if (_BBsInSlice.count(Cand->getBlock()) > 0) {
+      if (isInSlice(Cand->getBlock())) {
         break;
       }
       Cand = Cand->getIDom();
@@ -299,8 +737,8 @@ void ProgramSlice::computeAttractorBlocks() {
 /// Adds branches from immediate dominators which existed in the original
 /// function to the slice.
 void ProgramSlice::addDomBranches(DomTreeNode *cur, DomTreeNode *parent,
-                                  std::set<DomTreeNode *> &visited) {
-  if (_BBsInSlice.count(cur->getBlock())) {
+                                  SmallPtrSetImpl<DomTreeNode *> &visited) {
+  if (isInSlice(cur->getBlock())) {
     parent = cur;
   }
 
@@ -309,7 +747,7 @@ void ProgramSlice::addDomBranches(DomTreeNode *cur, DomTreeNode *parent,
       visited.insert(child);
       addDomBranches(child, parent, visited);
     }
-    if (_BBsInSlice.count(child->getBlock()) && parent) {
+    if (isInSlice(child->getBlock()) && parent) {
       BasicBlock *parentBB = _origToNewBBmap[parent->getBlock()];
       BasicBlock *childBB = _origToNewBBmap[child->getBlock()];
       if (parentBB->getTerminator() == nullptr) {
@@ -325,7 +763,7 @@ void ProgramSlice::addDomBranches(DomTreeNode *cur, DomTreeNode *parent,
 /// This function removes these.
 void updatePHINodes(Function *F) {
   for (BasicBlock &BB : *F) {
-    std::set<BasicBlock *> preds(pred_begin(&BB), pred_end(&BB));
+    SmallPtrSet<BasicBlock *, 8> preds(pred_begin(&BB), pred_end(&BB));
     for (auto I_it = BB.begin(); I_it != BB.end();) {
       PHINode *PN = dyn_cast<PHINode>(I_it);
       if (!PN) {
@@ -346,13 +784,13 @@ void updatePHINodes(Function *F) {
 /// delegate function, once instructions and basic blocks from the original
 /// function have been possibly removed.
 void ProgramSlice::rerouteBranches(Function *F) {
-  DominatorTree DT(*_parentFunction);
-  std::set<DomTreeNode *> visited;
+  DominatorTree &DT = _context.getDomTree();
+  SmallPtrSet<DomTreeNode *, 16> visited;
   DomTreeNode *parent = nullptr;
 
   DomTreeNode *init = DT.getRootNode();
   visited.insert(init);
-  if (_BBsInSlice.count(init->getBlock())) {
+  if (isInSlice(init->getBlock())) {
     parent = init;
   }
 
@@ -484,42 +922,248 @@ void ProgramSlice::rerouteBranches(Function *F) {
   updatePHINodes(F);
 }
 
-bool ProgramSlice::canOutline() {
-  DominatorTree DT(*_parentFunction);
-  LoopInfo LI = LoopInfo(DT);
-  AliasSetTracker AST(*_AA);
+using ModSummary = Optional<CalleeModSummary>;
 
-  // Build alias sets for memory instructions in the function.
-  for (BasicBlock &BB : *_parentFunction) {
-    for (Instruction &I : BB) {
-      if (StoreInst *SI = dyn_cast<StoreInst>(&I)) {
-        AST.add(SI);
-      } else if (CallBase *CB = dyn_cast<CallBase>(&I)) {
-        if (CB == _CallSite) {
-          continue;
+static ModSummary
+computeModSummary(const Function *F, AAResults &AA, TargetLibraryInfo &TLI,
+                  DenseMap<const Function *, ModSummary> &summaries);
+
+/// Adds to @param summary the memory through which a write to @param Loc is
+/// visible to the callers of the function. Returns false if the write may be
+/// visible through memory that the summary cannot describe.
+static bool addModifiedLocation(const MemoryLocation &Loc,
+                                CalleeModSummary &summary) {
+  if (isa<Constant>(Loc.Ptr)) {
+    summary.globals.push_back(Loc);
+    return true;
+  }
+
+  const Value *underlying = getUnderlyingObject(Loc.Ptr);
+  if (isa<AllocaInst>(underlying)) {
+    return true;
+  }
+  if (const Argument *A = dyn_cast<Argument>(underlying)) {
+    if (!is_contained(summary.args, A->getArgNo())) {
+      summary.args.push_back(A->getArgNo());
+    }
+    return true;
+  }
+  return false;
+}
+
+static ModSummary
+computeModSummary(const Function *F, AAResults &AA, TargetLibraryInfo &TLI,
+                  DenseMap<const Function *, ModSummary> &summaries) {
+  auto cached = summaries.find(F);
+  if (cached != summaries.end()) {
+    return cached->second;
+  }
+  // Recursive calls are summarized pessimistically
+  summaries[F] = None;
+
+  CalleeModSummary summary;
+  if (F->isDeclaration()) {
+    // errno is only read through errno accessors, never by loads in slices
+    if (AA.onlyReadsMemory(F) || isErrnoOnlyLibFunc(*F, TLI)) {
+      return summaries[F] = summary;
+    }
+    if (!AAResults::onlyAccessesArgPointees(AA.getModRefBehavior(F))) {
+      return None;
+    }
+    for (const Argument &A : F->args()) {
+      if (A.getType()->isPointerTy()) {
+        summary.args.push_back(A.getArgNo());
+      }
+    }
+    return summaries[F] = summary;
+  }
+
+  for (const Instruction &I : instructions(F)) {
+    if (!I.mayWriteToMemory()) {
+      continue;
+    }
+
+    if (const StoreInst *SI = dyn_cast<StoreInst>(&I)) {
+      if (!addModifiedLocation(MemoryLocation::get(SI), summary)) {
+        return None;
+      }
+    } else if (const AnyMemIntrinsic *MI = dyn_cast<AnyMemIntrinsic>(&I)) {
+      if (!addModifiedLocation(MemoryLocation::getForDest(MI), summary)) {
+        return None;
+      }
+    } else if (const CallBase *CB = dyn_cast<CallBase>(&I)) {
+      if (AA.onlyReadsMemory(CB)) {
+        continue;
+      }
+      const Function *callee = CB->getCalledFunction();
+      if (!callee) {
+        return None;
+      }
+      ModSummary calleeSummary =
+          computeModSummary(callee, AA, TLI, summaries);
+      if (!calleeSummary) {
+        return None;
+      }
+      for (unsigned idx : calleeSummary->args) {
+        if (idx >= CB->arg_size() ||
+            !addModifiedLocation(
+                MemoryLocation::getBeforeOrAfter(CB->getArgOperand(idx)),
+                summary)) {
+          return None;
+        }
+      }
+      append_range(summary.globals, calleeSummary->globals);
+    } else {
+      return None;
+    }
+  }
+  return summaries[F] = summary;
+}
+
+/// Returns whether instruction @param I may modify the memory at @param Loc,
+/// refining the mod/ref information of calls with the summary of the callee.
+static bool mayModify(const Instruction *I, const MemoryLocation &Loc,
+                      AAResults &AA, TargetLibraryInfo &TLI,
+                      DenseMap<const Function *, ModSummary> &summaries) {
+  if (!isModSet(AA.getModRefInfo(I, Loc))) {
+    return false;
+  }
+
+  const CallBase *CB = dyn_cast<CallBase>(I);
+  if (!CB || !CB->getCalledFunction()) {
+    return true;
+  }
+  ModSummary summary =
+      computeModSummary(CB->getCalledFunction(), AA, TLI, summaries);
+  if (!summary) {
+    return true;
+  }
+  return any_of(summary->args,
+                [&](unsigned idx) {
+                  return idx >= CB->arg_size() ||
+                         AA.alias(MemoryLocation::getBeforeOrAfter(
+                                      CB->getArgOperand(idx)),
+                                  Loc) != AliasResult::NoAlias;
+                }) ||
+         any_of(summary->globals, [&](const MemoryLocation &global) {
+           return AA.alias(global, Loc) != AliasResult::NoAlias;
+         });
+}
+
+/// Returns whether the memory at @param Loc, read by @param Reader, an
+/// instruction in the slice, still holds the same value whenever the thunk may
+/// be forced: in the call site, or at the other uses of the lazified value in
+/// the parent function. No write that may execute after @param Reader and
+/// before one of these points may modify @param Loc. The writes in the parent
+/// function are enumerated through @param MSSA, and the writes performed by
+/// the calls through summaries of the memory their callees modify.
+bool ProgramSlice::isReadSafe(
+    Instruction *Reader, const MemoryLocation &Loc, MemorySSA &MSSA,
+    DenseMap<const Function *, Optional<CalleeModSummary>> &summaries) {
+  const CallBase *underlyingCall =
+      dyn_cast<CallBase>(getUnderlyingObject(Loc.Ptr));
+  if (mayModify(_CallSite, Loc, *_AA, _TLI, summaries) ||
+      (underlyingCall && underlyingCall->getCalledFunction() &&
+       isErrnoAccessor(*underlyingCall->getCalledFunction()))) {
+    return false;
+  }
+
+  SmallVector<Instruction *> forcingPoints = {_CallSite};
+  for (User *U : _initial->users()) {
+    if (PHINode *PN = dyn_cast<PHINode>(U)) {
+      for (unsigned i = 0; i < PN->getNumIncomingValues(); ++i) {
+        if (PN->getIncomingValue(i) == _initial) {
+          forcingPoints.push_back(PN->getIncomingBlock(i)->getTerminator());
         }
-        AST.add(CB);
-      } else if (LoadInst *LI = dyn_cast<LoadInst>(&I)) {
-        AST.add(LI);
-      } else if (AnyMemSetInst *MSI = dyn_cast<AnyMemSetInst>(&I)) {
-        AST.add(MSI);
-      } else if (AnyMemTransferInst *MTI = dyn_cast<AnyMemTransferInst>(&I)) {
-        AST.add(MTI);
       }
+    } else if (U != _CallSite) {
+      forcingPoints.push_back(cast<Instruction>(U));
     }
   }
 
+  for (BasicBlock &BB : *_parentFunction) {
+    const MemorySSA::DefsList *defs = MSSA.getBlockDefs(&BB);
+    if (!defs) {
+      continue;
+    }
+    for (const MemoryAccess &MA : *defs) {
+      const MemoryDef *def = dyn_cast<MemoryDef>(&MA);
+      if (!def) {
+        continue;
+      }
+      Instruction *W = def->getMemoryInst();
+      if (W == _CallSite || is_contained(_bufferInitializers, W) ||
+          !mayModify(W, Loc, *_AA, _TLI, summaries) ||
+          !isPotentiallyReachable(Reader, W)) {
+        continue;
+      }
+      if (any_of(forcingPoints, [W](Instruction *forcingPoint) {
+            return isPotentiallyReachable(W, forcingPoint);
+          })) {
+        LLVM_DEBUG(dbgs() << "Memory read by " << *Reader
+                          << " may be clobbered by " << *W
+                          << " before the thunk is forced\n");
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/// Returns whether errno may be read after @param CB, a call in the slice,
+/// sets it: in the callee, which may force the thunk at any point, or by any
+/// instruction of the parent function that may execute after the call.
+bool ProgramSlice::errnoMayBeRead(const CallBase *CB) {
+  SmallPtrSet<const Function *, 16> visited;
+  if (callMayReadErrno(*_CallSite, _TLI, visited)) {
+    return true;
+  }
+
+  for (Instruction &I : instructions(*_parentFunction)) {
+    const CallBase *reader = dyn_cast<CallBase>(&I);
+    if (!reader || reader == _CallSite || isInSlice(reader)) {
+      continue;
+    }
+    visited.clear();
+    if (callMayReadErrno(*reader, _TLI, visited) &&
+        isPotentiallyReachable(CB, reader)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ProgramSlice::canOutline() {
+  DominatorTree &DT = _context.getDomTree();
+  LoopInfo &LI = _context.getLoopInfo();
+  MemorySSA MSSA(*_parentFunction, _AA, &DT);
+  DenseMap<const Function *, ModSummary> modSummaries;
+
   // LLVM does not provide alias/memory dependence information for allocas.
   // Thus, we track allocas that belong in the slice explicitly, so we can then
   // check if their memory is clobbered (changed) at any point in the slice
   // itself or at some other point in the parent function.
   SmallPtrSet<const Value *, 32> allocasInSlice;
-  for (const Instruction *I : _instsInSlice) {
+  for (const Instruction *I : getInstsInSlice()) {
     if (const AllocaInst *AI = dyn_cast<AllocaInst>(I)) {
       allocasInSlice.insert(AI);
     }
   }
 
+  // Instructions that may write to memory, other than the call being lazified,
+  // are the memory defs of the function
+  SmallVector<const Instruction *> writers;
+  for (BasicBlock &BB : *_parentFunction) {
+    if (const MemorySSA::DefsList *defs = MSSA.getBlockDefs(&BB)) {
+      for (const MemoryAccess &MA : *defs) {
+        const MemoryDef *def = dyn_cast<MemoryDef>(&MA);
+        if (def && def->getMemoryInst() != _CallSite) {
+          writers.push_back(def->getMemoryInst());
+        }
+      }
+    }
+  }
+
   for (BasicBlock &BB : *_parentFunction) {
     for (Instruction &I : BB) {
       if (StoreInst *SI = dyn_cast<StoreInst>(&I)) {
@@ -529,20 +1173,26 @@ bool ProgramSlice::canOutline() {
                  << *underlying << "\n";
           return false;
         }
-      } else if (LoadInst *LI = dyn_cast<LoadInst>(&I)) {
-        if (AST.getAliasSetFor(MemoryLocation::get(LI)).isMod()) {
-          Value *underlying = getUnderlyingObject(LI->getPointerOperand());
-          if (allocasInSlice.contains(underlying)) {
-            errs() << "Cannot outline slice because alloca is clobbered: "
-                   << *underlying << "\n";
-            return false;
-          }
+      } else if (LoadInst *Load = dyn_cast<LoadInst>(&I)) {
+        Value *underlying = getUnderlyingObject(Load->getPointerOperand());
+        if (!allocasInSlice.contains(underlying)) {
+          continue;
+        }
+        // Other than stores, the alloca may be written by the functions its
+        // address is passed to, or by memory intrinsics
+        MemoryLocation loc = MemoryLocation::get(Load);
+        if (any_of(writers, [&](const Instruction *W) {
+              return isModSet(_AA->getModRefInfo(W, loc));
+            })) {
+          errs() << "Cannot outline slice because alloca is clobbered: "
+                 << *underlying << "\n";
+          return false;
         }
       }
     }
   }
 
-  for (const Instruction *I : _instsInSlice) {
+  for (const Instruction *I : getInstsInSlice()) {
     if (I->mayThrow()) {
       errs() << "Cannot outline slice because inst may throw: " << *I << "\n";
       return false;
@@ -569,12 +1219,28 @@ bool ProgramSlice::canOutline() {
     // For instructions that may read or write to memory, we need some special
     // care to avoid load/store reordering and/or side effects.
     if (I->mayReadOrWriteMemory()) {
-      if (const LoadInst *LI = dyn_cast<LoadInst>(I)) {
-        // For loads, we invalidate outlining if its address can be modified.
-        // This is possible if the memory location pointed to by the load is
-        // written/modified by any possibly aliasing pointer or clobbering
-        // function call.
-        if (AST.getAliasSetFor(MemoryLocation::get(LI)).isMod()) {
+      if (is_contained(_bufferInitializers, I)) {
+        // Initializers of a migrated buffer only write to the buffer, which
+        // is not accessed by anything else before the thunk is forced, but
+        // they may read other memory, such as the source of a strcpy, which
+        // is subject to the same check as loads.
+        SmallVector<MemoryLocation, 2> sources;
+        getInitializerSources(*I, *_migratedBuffer, _TLI, sources);
+        for (const MemoryLocation &source : sources) {
+          if (!isReadSafe(const_cast<Instruction *>(I), source, MSSA,
+                          modSummaries)) {
+            errs() << "Cannot outline slice because buffer initializer reads "
+                      "memory that can be modified: "
+                   << *I << "\n";
+            return false;
+          }
+        }
+        continue;
+      } else if (const LoadInst *LI = dyn_cast<LoadInst>(I)) {
+        // For loads, we invalidate outlining if its address can be modified
+        // between the load and the points where the thunk may be forced.
+        if (!isReadSafe(const_cast<LoadInst *>(LI), MemoryLocation::get(LI),
+                        MSSA, modSummaries)) {
           errs()
               << "Cannot outline slice because load address can be modified: "
               << *LI << "\n";
@@ -584,7 +1250,18 @@ bool ProgramSlice::canOutline() {
       } else if (const CallBase *CB = dyn_cast<CallBase>(I)) {
         // For function calls, if the call has any side effects (as in, is not
         // read-only), we can't outline the slice.
-        if (!_AA->onlyReadsMemory(CB->getCalledFunction())) {
+        // Memoized delegates of other thunks only write their thunk, which is
+        // never observable, so they are treated as read-only.
+        // Library functions that only write errno can be deferred if
+        // nothing may read errno once they would have been called.
+        if (isErrnoOnlyLibFunc(*CB->getCalledFunction(), _TLI)) {
+          if (errnoMayBeRead(CB)) {
+            errs() << "Cannot outline because errno may be read after call: "
+                   << *CB << "\n";
+            return false;
+          }
+        } else if (!_AA->onlyReadsMemory(CB->getCalledFunction()) &&
+                   !isIdempotentDelegate(CB->getCalledFunction())) {
           errs() << "Cannot outline because call may write to memory: " << *CB
                  << "\n";
           return false;
@@ -616,12 +1293,48 @@ bool ProgramSlice::canOutline() {
     }
   }
 
-  if (LI.getLoopDepth(_CallSite->getParent()) > 0) {
-    for (const BasicBlock *BB : _BBsInSlice) {
-      if (LI.getLoopDepth(BB) <= LI.getLoopDepth(_CallSite->getParent())) {
-        errs() << "BB " << BB->getName()
-               << " is in same or lower loop depth as CallSite BB "
-               << _CallSite->getParent()->getName() << "\n";
+  // Captured pointers were part of the slice before it was cut, so they are
+  // subject to the same check
+  for (const Value *V : _environment) {
+    if (!isa<Instruction>(V) || !V->getType()->isPointerTy()) {
+      continue;
+    }
+    for (const Value *arg : _CallSite->args()) {
+      if (arg != _initial && arg->getType()->isPointerTy() &&
+          _AA->alias(arg, V) != AliasResult::NoAlias) {
+        errs() << "Cannot outline slice because pointer captured by slice is "
+                  "passed as argument to callee.\nPointer: "
+               << *V << "\nArgument: " << *arg << "\n";
+        return false;
+      }
+    }
+  }
+
+  // The slice may share blocks with the loops around the call site, as long as
+  // it computes the same value in every iteration. Slices that depend on
+  // values carried across iterations, or that contain the backedges of these
+  // loops, would have to reproduce the loop itself in the delegate.
+  for (const Loop *L = LI.getLoopFor(_CallSite->getParent()); L;
+       L = L->getParentLoop()) {
+    const BasicBlock *header = L->getHeader();
+    for (const BasicBlock *BB : getBBsInSlice()) {
+      if (!L->contains(BB)) {
+        continue;
+      }
+      const Instruction *term = BB->getTerminator();
+      if (isInSlice(term) && is_contained(successors(BB), header)) {
+        errs() << "Cannot outline slice because it contains the backedge of "
+                  "loop "
+               << header->getName() << " around the call site: " << *term
+               << "\n";
+        return false;
+      }
+    }
+    for (const PHINode &PN : header->phis()) {
+      if (isInSlice(&PN)) {
+        errs() << "Cannot outline slice because it depends on a value carried "
+                  "across iterations of the loop around the call site: "
+               << PN << "\n";
         return false;
       }
     }
@@ -641,7 +1354,7 @@ bool ProgramSlice::canOutline() {
   if (PHINode *PN = dyn_cast<PHINode>(_initial)) {
     if (PN->getNumIncomingValues() == 1) {
       BasicBlock *incBB = PN->getIncomingBlock(0);
-      if (_instsInSlice.count(incBB->getTerminator()) == 0) {
+      if (!isInSlice(incBB->getTerminator())) {
         return false;
       }
     }
@@ -650,12 +1363,34 @@ bool ProgramSlice::canOutline() {
   return true;
 }
 
-SmallVector<Value *> ProgramSlice::getOrigFunctionArgs() {
-  SmallVector<Value *> args;
-  for (auto &arg : _depArgs) {
-    args.push_back(cast<Value>(arg));
+SmallVector<Value *> ProgramSlice::getEnvironment() { return _environment; }
+
+SmallVector<const Instruction *> ProgramSlice::getInstsInSlice() const {
+  SmallVector<const Instruction *> insts;
+  for (unsigned number : _instsInSlice.set_bits()) {
+    insts.push_back(cast<Instruction>(_context.getValue(number)));
+  }
+  return insts;
+}
+
+SmallVector<const BasicBlock *> ProgramSlice::getBBsInSlice() const {
+  SmallVector<const BasicBlock *> BBs;
+  for (unsigned number : _BBsInSlice.set_bits()) {
+    BBs.push_back(_context.getBlock(number));
   }
-  return args;
+  return BBs;
+}
+
+SmallVector<Instruction *> ProgramSlice::getDeferredLibCalls() {
+  SmallVector<Instruction *> calls;
+  for (const Instruction *I : getInstsInSlice()) {
+    const CallBase *CB = dyn_cast<CallBase>(I);
+    if (CB && CB->getCalledFunction() &&
+        isErrnoOnlyLibFunc(*CB->getCalledFunction(), _TLI)) {
+      calls.push_back(const_cast<Instruction *>(I));
+    }
+  }
+  return calls;
 }
 
 /// Inserts a new BasicBlock in Function @param F, corresponding
@@ -674,7 +1409,7 @@ void ProgramSlice::insertNewBB(const BasicBlock *originalBB, Function *F) {
 /// to the BBs in the original function being sliced which
 /// contained instructions included in the slice.
 void ProgramSlice::populateFunctionWithBBs(Function *F) {
-  for (const BasicBlock *BB : _BBsInSlice) {
+  for (const BasicBlock *BB : getBBsInSlice()) {
     insertNewBB(BB, F);
   }
 }
@@ -684,7 +1419,7 @@ void ProgramSlice::populateFunctionWithBBs(Function *F) {
 void ProgramSlice::populateBBsWithInsts(Function *F) {
   for (BasicBlock &BB : *_parentFunction) {
     for (Instruction &origInst : BB) {
-      if (_instsInSlice.count(&origInst)) {
+      if (isInSlice(&origInst)) {
         Instruction *newInst = origInst.clone();
         _Imap.insert(std::make_pair(&origInst, newInst));
         IRBuilder<> builder(_origToNewBBmap[&BB]);
@@ -777,10 +1512,10 @@ void ProgramSlice::insertLoadForThunkParams(Function *F, bool memo) {
 
   builder.SetInsertPoint(&*(entry.getFirstInsertionPt()));
 
-  // memo thunk arguments start at 3, due to the memo flag and memoed value
-  // taking up two slots
-  unsigned int i = memo ? 3 : 1;
-  for (auto &arg : _depArgs) {
+  // memo thunk arguments start at 2, due to the memoed value taking up one
+  // slot
+  unsigned int i = memo ? 2 : 1;
+  for (Value *arg : _environment) {
     Value *new_arg_addr =
         builder.CreateStructGEP(thunkStructType, thunkStructPtr, i,
                                 "_wyvern_arg_addr_" + arg->getName());
@@ -797,6 +1532,23 @@ void ProgramSlice::insertLoadForThunkParams(Function *F, bool memo) {
   }
 }
 
+/// Updates the delegate function's code to make use of its parameters, which
+/// receive the values of the environment, rather than the original function's
+/// values.
+void ProgramSlice::mapEnvironmentToParams(Function *F) {
+  for (unsigned i = 0; i < _environment.size(); ++i) {
+    Value *arg = _environment[i];
+    Argument *new_arg = F->getArg(i);
+    new_arg->setName("_wyvern_arg_" + arg->getName());
+    arg->replaceUsesWithIf(new_arg, [F](Use &U) {
+      auto *UserI = dyn_cast<Instruction>(U.getUser());
+      return UserI && UserI->getParent()->getParent() == F;
+    });
+
+    _argMap[arg] = new_arg;
+  }
+}
+
 /// Outlines the given slice into a standalone Function, which
 /// encapsulates the computation of the original value in
 /// regards to which the slice was created.
@@ -806,30 +1558,15 @@ Function *ProgramSlice::outline() {
   FunctionType *delegateFunctionType =
       FunctionType::get(_initial->getType(), {thunkStructPtrType}, false);
 
-  // generate a random number to use as suffix for delegate function, to avoid
-  // naming conflicts
-  // NOTE: we cannot use a simple counter that gets incremented
-  // on every slice here, because when optimizing per translation unit, the same
-  // function may be sliced across different translation units
-  std::random_device rd;
-  std::mt19937 mt(rd());
-  std::uniform_int_distribution<int64_t> dist(1, 1000000000);
-  uint64_t random_num = dist(mt);
-  std::string functionName =
-      "_wyvern_slice_" + _parentFunction->getName().str() + "_" +
-      _initial->getName().str() + std::to_string(random_num);
+  // The name is made unique when the lazification pass finishes, from the
+  // contents of the delegate, so that it is stable across builds
+  std::string functionName = "_wyvern_slice_" +
+                             _parentFunction->getName().str() + "_" +
+                             _initial->getName().str();
   Function *F =
-      Function::Create(delegateFunctionType, Function::ExternalLinkage,
+      Function::Create(delegateFunctionType, Function::InternalLinkage,
                        functionName, _parentFunction->getParent());
 
-  // Let LLVM know that the delegate function is pure, so it can further
-  // optimize calls to it
-  AttrBuilder builder(_parentFunction->getContext());
-  builder.addAttribute(Attribute::ReadOnly);
-  builder.addAttribute(Attribute::NoUnwind);
-  builder.addAttribute(Attribute::WillReturn);
-  F->addFnAttrs(builder);
-
   F->arg_begin()->setName("_wyvern_thunkptr");
 
   populateFunctionWithBBs(F);
@@ -839,16 +1576,116 @@ Function *ProgramSlice::outline() {
   addReturnValue(F);
   reorderBlocks(F);
   insertLoadForThunkParams(F, false /*memo*/);
+  addDelegateAttributes(F);
   verifyFunction(*F);
   printFunctions(F);
 
   return F;
 }
 
+/// Outlines the given slice into a standalone Function, which receives the
+/// values of the environment as parameters, in the order of getEnvironment,
+/// rather than through a thunk.
+Function *ProgramSlice::outlineWithEnvironmentParams() {
+  SmallVector<Type *> paramTypes;
+  for (Value *arg : _environment) {
+    paramTypes.push_back(arg->getType());
+  }
+  FunctionType *delegateFunctionType =
+      FunctionType::get(_initial->getType(), paramTypes, false);
+
+  std::string functionName = "_wyvern_slice_env_" +
+                             _parentFunction->getName().str() + "_" +
+                             _initial->getName().str();
+  Function *F =
+      Function::Create(delegateFunctionType, Function::InternalLinkage,
+                       functionName, _parentFunction->getParent());
+
+  populateFunctionWithBBs(F);
+  populateBBsWithInsts(F);
+  reorganizeUses(F);
+  rerouteBranches(F);
+  addReturnValue(F);
+  reorderBlocks(F);
+  mapEnvironmentToParams(F);
+  addDelegateAttributes(F);
+  verifyFunction(*F);
+  printFunctions(F);
+
+  return F;
+}
+
+/// Returns whether @param I may write to memory that is visible outside of
+/// its function @param F: anything but the allocas of @param F.
+static bool mayWriteNonLocalMemory(Instruction &I) {
+  if (!I.mayWriteToMemory() || I.isLifetimeStartOrEnd()) {
+    return false;
+  }
+  Value *ptr = getLoadStorePointerOperand(&I);
+  if (MemIntrinsic *MI = dyn_cast<MemIntrinsic>(&I)) {
+    ptr = MI->getDest();
+  }
+  return !ptr || I.isVolatile() || I.isAtomic() ||
+         !isa<AllocaInst>(getUnderlyingObject(ptr));
+}
+
+/// Describes the memory effects of delegate function @param F to LLVM, so it
+/// can further optimize calls to it. Delegates read their thunk, unless they
+/// receive the environment as parameters, and memoized delegates also write
+/// the memoized value back to it. Other than that, they
+/// access the memory that the slice accesses, which may include writes, such
+/// as errno by library calls or the thunks of memoized delegates called by the
+/// slice. Delegates are only read-only if none of their instructions writes
+/// to memory outside of their own frame. Evaluating a thunk again yields the
+/// same value and has no further effect, which is recorded with the
+/// idempotence marker, since LLVM has no attribute for it.
+void ProgramSlice::addDelegateAttributes(Function *F) {
+  bool accessesMemory = any_of(instructions(F), [](Instruction &I) {
+    return I.mayReadOrWriteMemory() && !I.isLifetimeStartOrEnd();
+  });
+  bool onlyAccessesParams = all_of(instructions(F), [](Instruction &I) {
+    if (!I.mayReadOrWriteMemory()) {
+      return true;
+    }
+    Value *ptr = getLoadStorePointerOperand(&I);
+    return ptr && !I.isVolatile() && !I.isAtomic() &&
+           isa<Argument>(getUnderlyingObject(ptr));
+  });
+  bool writesMemory = any_of(instructions(F), mayWriteNonLocalMemory);
+
+  AttrBuilder builder(F->getContext());
+  builder.addAttribute(Attribute::NoUnwind);
+  builder.addAttribute(Attribute::WillReturn);
+  if (!accessesMemory) {
+    builder.addAttribute(Attribute::ReadNone);
+  } else if (!writesMemory) {
+    builder.addAttribute(Attribute::ReadOnly);
+  }
+  if (accessesMemory && onlyAccessesParams) {
+    builder.addAttribute(Attribute::ArgMemOnly);
+  }
+  F->addFnAttrs(builder);
+
+  // Slices may return the pointers of their environment
+  for (Argument &arg : F->args()) {
+    if (arg.getType()->isPointerTy() &&
+        !PointerMayBeCaptured(&arg, true /*ReturnCaptures*/,
+                              true /*StoreCaptures*/)) {
+      F->addParamAttr(arg.getArgNo(), Attribute::NoCapture);
+    }
+  }
+  F->setMetadata(IdempotentDelegateMD, MDNode::get(F->getContext(), {}));
+}
+
+bool ProgramSlice::isIdempotentDelegate(const Function *F) {
+  return F && F->hasMetadata(IdempotentDelegateMD);
+}
+
 /// Adds memoization code to the delegate function. This includes the check to
 /// see if its value has been memoized, and the code to update the memoization
 /// cache once invoked.
-void ProgramSlice::addMemoizationCode(Function *F, ReturnInst *new_ret) {
+void ProgramSlice::addMemoizationCode(Function *F, ReturnInst *new_ret,
+                                      MemoizedValueFunctionMap &memoFunctions) {
   StructType *thunkStructType = getThunkStructType(true);
   IRBuilder<> builder(F->getContext());
   LLVMContext &Ctx = F->getParent()->getContext();
@@ -863,7 +1700,8 @@ void ProgramSlice::addMemoizationCode(Function *F, ReturnInst *new_ret) {
   BasicBlock *memoRetBlock =
       BasicBlock::Create(Ctx, "_wyvern_memo_ret", F, oldEntry);
 
-  // load addresses and values for memo flag and memoed value
+  // load addresses and values for the function pointer, which also serves as
+  // the memo flag, and memoed value
   Value *argValue = F->arg_begin();
   builder.SetInsertPoint(newEntry);
   Value *memoedValueGEP = builder.CreateStructGEP(thunkStructType, argValue, 1,
@@ -872,11 +1710,16 @@ void ProgramSlice::addMemoizationCode(Function *F, ReturnInst *new_ret) {
       builder.CreateLoad(thunkStructType->getStructElementType(1),
                          memoedValueGEP, "_wyvern_memo_val");
 
-  Value *memoFlagGEP = builder.CreateStructGEP(thunkStructType, argValue, 2,
-                                               "_wyvern_memo_flag_addr");
-  LoadInst *memoFlagLoad =
-      builder.CreateLoad(thunkStructType->getStructElementType(2), memoFlagGEP,
-                         "_wyvern_memo_flag");
+  Value *fptrGEP = builder.CreateStructGEP(thunkStructType, argValue, 0,
+                                           "_wyvern_thunk_fptr_addr");
+  LoadInst *fptrLoad = builder.CreateLoad(
+      thunkStructType->getStructElementType(0), fptrGEP, "_wyvern_thunkfptr");
+  Constant *memoedFPtr = ConstantExpr::getPointerCast(
+      getMemoizedValueFunction(_initial->getType(), *F->getParent(),
+                               memoFunctions),
+      thunkStructType->getStructElementType(0));
+  Value *memoFlag =
+      builder.CreateICmpEQ(fptrLoad, memoedFPtr, "_wyvern_memo_flag");
 
   if (_thunkDebugging) {
     std::string dbg_fmt;
@@ -885,24 +1728,22 @@ void ProgramSlice::addMemoizationCode(Function *F, ReturnInst *new_ret) {
 
     rso << "== Wyvern Debugging ==\nEvaluating thunk!\n";
     rso << "\ti1 memo_flag = %d\n";
-    debug_args.push_back(memoFlagLoad);
+    debug_args.push_back(builder.CreateZExt(memoFlag, builder.getInt32Ty()));
     rso << "======================\n";
     generatePrintf(dbg_fmt, debug_args, builder);
   }
 
   // add if (memoFlag == true) { return memo_val; }
-  Value *toBool = builder.CreateTruncOrBitCast(
-      memoFlagLoad, builder.getInt1Ty(), "_wyvern_memo_flag_bool");
-  BranchInst *memoCheckBranch =
-      builder.CreateCondBr(toBool, memoRetBlock, oldEntry);
+  builder.CreateCondBr(memoFlag, memoRetBlock, oldEntry);
 
   builder.SetInsertPoint(memoRetBlock);
-  ReturnInst *memoedValueRet = builder.CreateRet(memoedValueLoad);
+  builder.CreateRet(memoedValueLoad);
 
-  // store computed value and update memoization flag
+  // store computed value and update the function pointer, so that further
+  // evaluations return it
   builder.SetInsertPoint(new_ret);
-  builder.CreateStore(builder.getInt1(1), memoFlagGEP);
   builder.CreateStore(new_ret->getReturnValue(), memoedValueGEP);
+  builder.CreateStore(memoedFPtr, fptrGEP);
 }
 
 /// Outlines the given slice into a standalone Function, which
@@ -910,32 +1751,20 @@ void ProgramSlice::addMemoizationCode(Function *F, ReturnInst *new_ret) {
 /// regards to which the slice was created. Adds memoization
 /// code so that the function saves its evaluated value and
 /// returns it on successive executions.
-Function *ProgramSlice::memoizedOutline() {
+Function *
+ProgramSlice::memoizedOutline(MemoizedValueFunctionMap &memoFunctions) {
   StructType *thunkStructType = getThunkStructType(true);
   PointerType *thunkStructPtrType = thunkStructType->getPointerTo();
   FunctionType *delegateFunctionType =
       FunctionType::get(_initial->getType(), {thunkStructPtrType}, false);
 
-  std::random_device rd;
-  std::mt19937 mt(rd());
-  std::uniform_int_distribution<int64_t> dist(1, 1000000000);
-  uint64_t random_num = dist(mt);
-
-  std::string functionName =
-      "_wyvern_slice_memo_" + _parentFunction->getName().str() + "_" +
-      _initial->getName().str() + std::to_string(random_num);
+  std::string functionName = "_wyvern_slice_memo_" +
+                             _parentFunction->getName().str() + "_" +
+                             _initial->getName().str();
   Function *F =
-      Function::Create(delegateFunctionType, Function::ExternalLinkage,
+      Function::Create(delegateFunctionType, Function::InternalLinkage,
                        functionName, _parentFunction->getParent());
 
-  // Let LLVM know that the delegate function is pure, so it can further
-  // optimize calls to it
-  AttrBuilder builder(_parentFunction->getContext());
-  builder.addAttribute(Attribute::ReadOnly);
-  builder.addAttribute(Attribute::NoUnwind);
-  builder.addAttribute(Attribute::WillReturn);
-  F->addFnAttrs(builder);
-
   F->arg_begin()->setName("_wyvern_thunkptr");
 
   populateFunctionWithBBs(F);
@@ -945,7 +1774,8 @@ Function *ProgramSlice::memoizedOutline() {
   ReturnInst *new_ret = addReturnValue(F);
   reorderBlocks(F);
   insertLoadForThunkParams(F, true /*memo*/);
-  addMemoizationCode(F, new_ret);
+  addMemoizationCode(F, new_ret, memoFunctions);
+  addDelegateAttributes(F);
 
   verifyFunction(*F);
   verifyFunction(*_initial->getParent()->getParent());
@@ -1,43 +1,121 @@
 #include <map>
 #include <set>
 
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemoryLocation.h"
 
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 
+#include "SlicingContext.h"
+
 namespace llvm {
 
+class MemorySSA;
+
+/// Summary of the memory that calls to a function may modify, besides memory
+/// local to the function or to the functions it calls, which is never visible
+/// to its callers.
+struct CalleeModSummary {
+  /// indices of the formal parameters whose pointees may be modified
+  SmallVector<unsigned> args;
+
+  /// global memory that may be modified, addressed by constant pointers
+  SmallVector<MemoryLocation> globals;
+};
+
+/// Functions returned by ProgramSlice::getMemoizedValueFunction, keyed by the
+/// type of the value they return, which determines the layout of the thunk
+/// header they read.
+using MemoizedValueFunctionMap = DenseMap<Type *, Function *>;
+
+/// Metadata attached to delegate functions, marking them as idempotent.
+static constexpr const char *IdempotentDelegateMD = "wyvern.idempotent";
+
 class ProgramSlice {
 public:
-  /// Creates a backward slice of function F in terms of slice criterion I,
-  /// which is passed as a parameter in call CallSite. Optionally, receives the
-  /// result of an Alias Analysis in AA to perform memory safety analysis.
-  ProgramSlice(Instruction &I, Function &F, CallInst &CallSite, AAResults *AA,
-               TargetLibraryInfo &TLI, bool thunkDebugging);
+  /// Creates a backward slice of the function of context in terms of slice
+  /// criterion I, which is passed as a parameter in call CallSite. The
+  /// control-flow analyses of the function are taken from context, which may
+  /// be shared by several slices. Optionally, receives the result of an Alias
+  /// Analysis in AA to perform memory safety analysis.
+  ProgramSlice(Instruction &I, SlicingContext &context, CallInst &CallSite,
+               AAResults *AA, TargetLibraryInfo &TLI, bool thunkDebugging);
 
   /// Returns whether the slice can be safely outlined into a delegate function.
   bool canOutline();
 
-  /// Returns the set of arguments of the slice's parent function. Used to
-  /// initialize the environment for thunks that use the slice as their delegate
-  /// function.
-  SmallVector<Value *> getOrigFunctionArgs();
+  /// Returns the values of the slice's parent function that the slice takes
+  /// from its environment: the formal arguments it depends on, and the values
+  /// captured eagerly rather than recomputed. Used to initialize the
+  /// environment for thunks that use the slice as their delegate function.
+  SmallVector<Value *> getEnvironment();
+
+  /// Returns whether the lazified value points into a local buffer that the
+  /// delegate builds, rather than the parent function. The delegate writes to
+  /// the buffer, so its thunk must be memoized.
+  bool migratesStackBuffer() const { return _migratedBuffer != nullptr; }
+
+  /// Returns the instructions that initialize the migrated buffer in the
+  /// parent function, which must be erased once the slice is outlined.
+  ArrayRef<Instruction *> getBufferInitializers() const {
+    return _bufferInitializers;
+  }
+
+  /// Returns the calls in the slice to library functions whose only side
+  /// effect is setting errno. Unlike the other instructions in the slice, they
+  /// are not trivially dead in the parent function once it is lazified.
+  SmallVector<Instruction *> getDeferredLibCalls();
 
   /// Returns the struct type of the slice's corresponding thunk used for
   /// lazification.
   StructType *getThunkStructType(bool memo = false);
 
+  /// Returns the canonical header shared by all thunks whose delegate returns
+  /// @param valueType: the delegate function pointer, followed by the
+  /// memoization state if @param memo is set. Unlike the thunk types of
+  /// slices, which also hold their environments, headers are structurally
+  /// uniqued, so code that only accesses the header can be shared by thunks of
+  /// different slices.
+  static StructType *getThunkHeaderType(Type *valueType, bool memo = false);
+
+  /// Returns the type of the delegate functions of thunks of type
+  /// @param thunkStructType, whose first field is a pointer to their delegate.
+  static FunctionType *getDelegateFunctionType(StructType *thunkStructType);
+
+  /// Returns the function that memoized thunks whose delegate returns
+  /// @param valueType point to once evaluated, creating it in @param M if
+  /// necessary. It returns the memoized value, so code that calls the function
+  /// pointer of a thunk still gets its value, while code that knows the thunk
+  /// is memoized checks whether the pointer is this function instead of
+  /// checking a separate flag. Functions are cached in @param functions.
+  static Function *
+  getMemoizedValueFunction(Type *valueType, Module &M,
+                           MemoizedValueFunctionMap &functions);
+
+  /// Returns whether @param F is a delegate function, whose calls evaluate
+  /// thunks idempotently: evaluating the same thunk more than once always
+  /// yields the same value, with no further effects.
+  static bool isIdempotentDelegate(const Function *F);
+
   /// Returns the delegate function resulted from outlining the slice.
   Function *outline();
 
   /// Returns the delegate function resulted from outlining the slice, using
-  /// memoization.
-  Function *memoizedOutline();
+  /// memoization. Evaluated thunks point to the function of
+  /// @param memoFunctions that returns their value.
+  Function *memoizedOutline(MemoizedValueFunctionMap &memoFunctions);
+
+  /// Returns the delegate function resulted from outlining the slice, which
+  /// receives the values of getEnvironment as parameters instead of a thunk.
+  Function *outlineWithEnvironmentParams();
 
 private:
   void insertLoadForThunkParams(Function *F, bool memo);
+  void mapEnvironmentToParams(Function *F);
   void printFunctions(Function *F);
   void reorderBlocks(Function *F);
   void rerouteBranches(Function *F);
@@ -46,13 +124,19 @@ private:
   void populateBBsWithInsts(Function *F);
   void populateFunctionWithBBs(Function *F);
   void addMissingTerminators(Function *F);
-  void addMemoizationCode(Function *F, ReturnInst *new_ret);
+  void addMemoizationCode(Function *F, ReturnInst *new_ret,
+                          MemoizedValueFunctionMap &memoFunctions);
+  void addDelegateAttributes(Function *F);
   void insertNewBB(const BasicBlock *originalBB, Function *F);
   void printSlice();
   void computeAttractorBlocks();
   void addDomBranches(DomTreeNode *cur, DomTreeNode *parent,
-                      std::set<DomTreeNode *> &visited);
+                      SmallPtrSetImpl<DomTreeNode *> &visited);
   StructType *computeStructType(bool memo);
+  bool errnoMayBeRead(const CallBase *CB);
+  bool isReadSafe(
+      Instruction *Reader, const MemoryLocation &Loc, MemorySSA &MSSA,
+      DenseMap<const Function *, Optional<CalleeModSummary>> &summaries);
 
   /// pointer to the Instruction used as slice criterion
   Instruction *_initial;
@@ -60,16 +144,39 @@ private:
   /// function being sliced
   Function *_parentFunction;
 
-  /// list of formal arguments on which the slice depends on (if any)
-  SmallVector<Argument *> _depArgs;
+  /// analyses of the function being sliced, shared with its other slices
+  SlicingContext &_context;
+
+  /// list of formal arguments and captured values on which the slice depends
+  /// (if any), in the order they are laid out in the thunk
+  SmallVector<Value *> _environment;
+
+  /// local buffer migrated to the delegate (if any), and the instructions that
+  /// initialize it
+  AllocaInst *_migratedBuffer = nullptr;
+  SmallVector<Instruction *> _bufferInitializers;
 
   /// set of instructions that must be in the slice, accordingto dependence
-  /// analysis
-  std::set<const Instruction *> _instsInSlice;
+  /// analysis, indexed by their numbers in the slicing context
+  BitVector _instsInSlice;
 
   /// set of BasicBLocks that must be in the slice, according to dependence
-  /// analysis
-  std::set<const BasicBlock *> _BBsInSlice;
+  /// analysis, indexed by their numbers in the slicing context
+  BitVector _BBsInSlice;
+
+  /// Returns whether @param I or @param BB belong to the slice. The virtual
+  /// root of the post-dominator tree has no block, and is never in the slice.
+  bool isInSlice(const Instruction *I) const {
+    return _context.contains(_instsInSlice, I);
+  }
+  bool isInSlice(const BasicBlock *BB) const {
+    return BB && _BBsInSlice.test(_context.getBlockNumber(BB));
+  }
+
+  /// Returns the instructions and BasicBlocks in the slice, in the order of
+  /// the parent function.
+  SmallVector<const Instruction *> getInstsInSlice() const;
+  SmallVector<const BasicBlock *> getBBsInSlice() const;
 
   /// function call being lazified
   CallInst *_CallSite;
@@ -77,21 +184,21 @@ private:
   // @_Imap ->
   /// maps each BasicBlock to its attractor (its first  dominator), used for
   /// rearranging control flow
-  std::map<const BasicBlock *, const BasicBlock *> _attractors;
+  DenseMap<const BasicBlock *, const BasicBlock *> _attractors;
 
-  /// maps original function arguments to new counterparts in the slice function
-  std::map<Argument *, Value *> _argMap;
+  /// maps environment values to their new counterparts in the slice function
+  DenseMap<Value *, Value *> _argMap;
 
   /// maps BasicBlocks in the original function to their new cloned counterparts
   /// in the slice
-  std::map<const BasicBlock *, BasicBlock *> _origToNewBBmap;
+  DenseMap<const BasicBlock *, BasicBlock *> _origToNewBBmap;
 
   /// same as above, but in the opposite direction
-  std::map<BasicBlock *, const BasicBlock *> _newToOrigBBmap;
+  DenseMap<BasicBlock *, const BasicBlock *> _newToOrigBBmap;
 
   /// maps Instructions in the original function to their cloned counterparts in
   /// the slice
-  std::map<Instruction *, Instruction *> _Imap;
+  DenseMap<Instruction *, Instruction *> _Imap;
 
   /// We store the slice's thunk types, because LLVM does not cache types based
   /// on structure
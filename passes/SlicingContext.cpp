@@ -0,0 +1,157 @@
+#include "SlicingContext.h"
+
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#define DEBUG_TYPE "ProgramSlicing"
+
+using namespace llvm;
+
+/// Returns the block whose predicate should control the phi-functions in BB
+static const BasicBlock *getController(const BasicBlock *BB, DominatorTree &DT,
+                                       PostDominatorTree &PDT) {
+  const DomTreeNode *dom_node = DT.getNode(BB);
+  while (dom_node) {
+    const BasicBlock *dom_BB = dom_node->getBlock();
+    if (!PDT.dominates(BB, dom_BB)) {
+      return dom_BB;
+    } else {
+      dom_node = dom_node->getIDom();
+    }
+  }
+  return NULL;
+}
+
+/// Returns the predicate of the given basic block, which will be used to gate
+/// another basic block's phi-functions.
+static const Value *getGate(const BasicBlock *BB) {
+  const Value *condition;
+
+  const Instruction *terminator = BB->getTerminator();
+  if (const BranchInst *BI = dyn_cast<BranchInst>(terminator)) {
+    assert(BI->isConditional() && "Inconditional terminator!");
+    condition = BI;
+  }
+
+  else if (const SwitchInst *SI = dyn_cast<SwitchInst>(terminator)) {
+    condition = SI;
+  }
+
+  return condition;
+}
+
+SlicingContext::SlicingContext(Function &F)
+    : _F(F), _DT(F), _PDT(F), _LI(_DT) {
+  for (const Argument &A : F.args()) {
+    getNumber(&A);
+  }
+  for (const BasicBlock &BB : F) {
+    _blockNumbers[&BB] = _blocks.size();
+    _blocks.push_back(&BB);
+    for (const Instruction &I : BB) {
+      getNumber(&I);
+    }
+  }
+  computeGates();
+}
+
+double SlicingContext::getRelativeFrequency(const BasicBlock *BB) {
+  if (!_BFI) {
+    _BPI = std::make_unique<BranchProbabilityInfo>(_F, _LI, nullptr, &_DT,
+                                                   &_PDT);
+    _BFI = std::make_unique<BlockFrequencyInfo>(_F, *_BPI, _LI);
+  }
+  return (double)_BFI->getBlockFreq(BB).getFrequency() /
+         (double)_BFI->getEntryFreq();
+}
+
+unsigned SlicingContext::getNumber(const Value *V) {
+  auto [it, inserted] = _valueNumbers.try_emplace(V, _values.size());
+  if (inserted) {
+    _values.push_back(V);
+  }
+  return it->second;
+}
+
+bool SlicingContext::contains(const BitVector &values, const Value *V) const {
+  auto it = _valueNumbers.find(V);
+  return it != _valueNumbers.end() && it->second < values.size() &&
+         values.test(it->second);
+}
+
+const SlicingContext::Closure *
+SlicingContext::getClosure(const Value *V) const {
+  auto number = _valueNumbers.find(V);
+  if (number == _valueNumbers.end()) {
+    return nullptr;
+  }
+  auto it = _closures.find(number->second);
+  return it == _closures.end() ? nullptr : &it->second;
+}
+
+void SlicingContext::setClosure(const Value *V, Closure closure) {
+  _closures[getNumber(V)] = std::move(closure);
+}
+
+void SlicingContext::invalidateClosures(ArrayRef<const Value *> changed) {
+  SmallVector<unsigned, 8> numbers;
+  for (const Value *V : changed) {
+    auto it = _valueNumbers.find(V);
+    if (it != _valueNumbers.end()) {
+      numbers.push_back(it->second);
+    }
+  }
+
+  SmallVector<unsigned, 8> stale;
+  for (auto &[number, closure] : _closures) {
+    const BitVector &values = closure.values;
+    if (any_of(numbers, [&values](unsigned n) {
+          return n < values.size() && values.test(n);
+        })) {
+      stale.push_back(number);
+    }
+  }
+  for (unsigned number : stale) {
+    _closures.erase(number);
+  }
+}
+
+void SlicingContext::forgetValue(const Value *V) {
+  invalidateClosures(V);
+  auto it = _valueNumbers.find(V);
+  if (it != _valueNumbers.end()) {
+    _values[it->second] = nullptr;
+    _valueNumbers.erase(it);
+  }
+}
+
+/// Computes the gates for all basic blocks in the function, which are stored
+/// in a vector indexed by block number.
+void SlicingContext::computeGates() {
+  _gates.resize(_blocks.size());
+  for (const BasicBlock &BB : _F) {
+    SmallVector<const Value *, 2> &BB_gates = _gates[getBlockNumber(&BB)];
+    const unsigned num_preds = pred_size(&BB);
+    if (num_preds > 1) {
+      LLVM_DEBUG(dbgs() << BB.getName() << ":\n");
+      for (const BasicBlock *pred : predecessors(&BB)) {
+        LLVM_DEBUG(dbgs() << " - " << pred->getName() << " -> ");
+        if (_DT.dominates(pred, &BB) && !_PDT.dominates(&BB, pred)) {
+          LLVM_DEBUG(dbgs() << " DOM " << getGate(pred)->getName() << " -> ");
+          BB_gates.push_back(getGate(pred));
+        } else {
+          const BasicBlock *ctrl_BB = getController(pred, _DT, _PDT);
+          if (ctrl_BB) {
+            LLVM_DEBUG(dbgs() << " R-CTRL "
+                              << "CTRL_BB: " << ctrl_BB->getName() << " "
+                              << getGate(ctrl_BB)->getName());
+            BB_gates.push_back(getGate(ctrl_BB));
+          }
+        }
+        LLVM_DEBUG(dbgs() << ";\n");
+      }
+    }
+  }
+}
@@ -0,0 +1,109 @@
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+
+#include <memory>
+
+namespace llvm {
+
+/// Analyses of a function that are shared by all the slices taken from it, so
+/// that slicing N call sites of a function does not compute them N times.
+/// These analyses only depend on the control flow of the function, which
+/// lazifying a call site never changes in its caller: the code that builds
+/// and evaluates thunks is inserted in existing blocks. Memory analyses depend
+/// on the alias analysis, which the legacy pass manager recomputes on every
+/// request, so they are still built per slice.
+class SlicingContext {
+public:
+  SlicingContext(Function &F);
+
+  Function &getFunction() { return _F; }
+  DominatorTree &getDomTree() { return _DT; }
+  PostDominatorTree &getPostDomTree() { return _PDT; }
+  LoopInfo &getLoopInfo() { return _LI; }
+
+  /// Returns the estimated frequency of @param BB, relative to the entry of
+  /// the function, used to rank call sites when there is no profile. Block
+  /// frequencies are only computed on the first call, since call sites with a
+  /// profile are ranked by the profile instead.
+  double getRelativeFrequency(const BasicBlock *BB);
+
+  /// Returns the gates of the phi-functions of @param BB: the branches that
+  /// decide which of its incoming values they take.
+  ArrayRef<const Value *> getGates(const BasicBlock *BB) const {
+    return _gates[getBlockNumber(BB)];
+  }
+
+  /// Slices are sets of values and blocks of the function, represented as bit
+  /// vectors indexed by the dense numbering below. Arguments are numbered
+  /// first, by position, followed by the instructions in the order of the
+  /// function. Instructions inserted after the context was built are numbered
+  /// on demand, when they are first reached by a slice.
+  unsigned getNumber(const Value *V);
+  const Value *getValue(unsigned number) const { return _values[number]; }
+  unsigned getNumValues() const { return _values.size(); }
+
+  /// Returns whether @param V belongs to @param values, a set of values
+  /// indexed by their numbers.
+  bool contains(const BitVector &values, const Value *V) const;
+
+  unsigned getBlockNumber(const BasicBlock *BB) const {
+    auto it = _blockNumbers.find(BB);
+    assert(it != _blockNumbers.end() && "Block created after the context!");
+    return it->second;
+  }
+  const BasicBlock *getBlock(unsigned number) const { return _blocks[number]; }
+  unsigned getNumBlocks() const { return _blocks.size(); }
+
+  /// Backward closure of a value over the dependence graph of the function,
+  /// whose edges are the operands of instructions and the gates of
+  /// phi-functions: the values and blocks a slice of the value contains.
+  struct Closure {
+    BitVector values;
+    BitVector blocks;
+  };
+
+  /// Returns the memoized closure of @param V, or nullptr if there is none.
+  const Closure *getClosure(const Value *V) const;
+  void setClosure(const Value *V, Closure closure);
+
+  /// Drops the memoized closures that contain any of @param changed, whose
+  /// operands are about to be rewritten. Lazifying a call site only rewrites
+  /// the call and the uses of the lazified value, so the closures that reach
+  /// neither of them are kept.
+  void invalidateClosures(ArrayRef<const Value *> changed);
+
+  /// Drops the memoized closures that contain @param V, which is about to be
+  /// erased, and forgets its number, so that a value created later at the
+  /// same address is numbered anew.
+  void forgetValue(const Value *V);
+
+private:
+  void computeGates();
+
+  Function &_F;
+  DominatorTree _DT;
+  PostDominatorTree _PDT;
+  LoopInfo _LI;
+  std::unique_ptr<BranchProbabilityInfo> _BPI;
+  std::unique_ptr<BlockFrequencyInfo> _BFI;
+
+  /// dense numbering of the values and blocks of the function
+  DenseMap<const Value *, unsigned> _valueNumbers;
+  SmallVector<const Value *> _values;
+  DenseMap<const BasicBlock *, unsigned> _blockNumbers;
+  SmallVector<const BasicBlock *> _blocks;
+
+  /// gates of the phi-functions of each basic block, indexed by block number
+  SmallVector<SmallVector<const Value *, 2>> _gates;
+
+  /// memoized closures, indexed by value number
+  DenseMap<unsigned, Closure> _closures;
+};
+} // namespace llvm
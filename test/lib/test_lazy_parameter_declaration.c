@@ -0,0 +1,15 @@
+// Definition of the function whose parameter is annotated as lazy in
+// ../test_lazy_parameter_declaration.c. The same annotation makes the pass
+// emit a lazy entry point for it.
+
+#include "../../include/wyvern.h"
+
+int report(int verbose, int position);
+WYVERN_LAZY_DECL(report, 1);
+
+int report(int verbose, int position) {
+	if (verbose) {
+		return position;
+	}
+	return 0;
+}
@@ -1,4 +1,6 @@
-TEST_FILES=$(find . -name "*test*.c")
+# Files in lib/ hold the definitions of functions that the test with the same
+# name only declares, and are linked with it
+TEST_FILES=$(find . -name "*test*.c" -not -path "./lib/*")
 
 memo=${1}
 use_clang=${2}
@@ -16,12 +18,34 @@ fi
 echo "MEMO_FLAG=${MEMO_FLAG}"
 echo "CLANG=${USE_CLANG}"
 
+# Tests may pass extra flags to the lazification pass in "// OPT-FLAGS:" lines,
+# and describe the lazified code in FileCheck lines. CHECK lines apply to both
+# runs, and MEMO and NOMEMO lines to the runs with and without memoization.
+CHECK_PREFIX="NOMEMO"
+if [ "$MEMO_FLAG" = "true" ]; then
+	CHECK_PREFIX="MEMO"
+fi
+FAILED_TESTS=""
+
 for f in ${TEST_FILES}; do
 	echo "========= Running test ${f} ========="
+	LIB_FILE="lib/$(basename ${f})"
+	if [ ! -f "${LIB_FILE}" ]; then
+		LIB_FILE=""
+	fi
 	if [ "$USE_CLANG" = "true" ]; then
-		clang -flegacy-pass-manager -flto -Xclang -disable-O0-optnone -fuse-ld=lld -Wl,-mllvm=-load=../build/passes/libWyvern.so ${f} -O0 -Wl,-mllvm=-stats -o test
+		clang -flegacy-pass-manager -flto -Xclang -disable-O0-optnone -fuse-ld=lld -Wl,-mllvm=-load=../build/passes/libWyvern.so ${f} ${LIB_FILE} -O0 -Wl,-mllvm=-stats -o test
 	else
 		clang -S -c -emit-llvm -Xclang -disable-O0-optnone ${f} -o test.ll
-		opt -load ../build/passes/libWyvern.so -S -mem2reg -mergereturn -function-attrs -loop-simplify -lcssa -enable-new-pm=0 -lazify-callsites -wylazy-memo=${MEMO_FLAG} -instcombine -stats test.ll -o test_lazyfied.ll
+		OPT_FLAGS=$(sed -n 's|^// OPT-FLAGS: ||p' ${f})
+		opt -load ../build/passes/libWyvern.so -S -mem2reg -mergereturn -function-attrs -loop-simplify -lcssa -enable-new-pm=0 -lazify-callsites -wylazy-memo=${MEMO_FLAG} ${OPT_FLAGS} -instcombine -stats test.ll -o test_lazyfied.ll
+		if grep -qE "^// (CHECK|MEMO|NOMEMO)" ${f}; then
+			FileCheck --allow-unused-prefixes --check-prefixes=CHECK,${CHECK_PREFIX} ${f} < test_lazyfied.ll || FAILED_TESTS="${FAILED_TESTS} ${f}"
+		fi
 	fi
 done
+
+if [ -n "${FAILED_TESTS}" ]; then
+	echo "Failed tests:${FAILED_TESTS}"
+	exit 1
+fi
@@ -0,0 +1,45 @@
+// The position passed to report() is annotated as lazy, and the key passed to
+// lookup() as eager. report() uses its position on every path, so only the
+// annotation makes it a candidate, while lookup() has a path that does not use
+// its key. Only the position should be lazified, and report() should get a
+// lazy entry point for callers in other translation units.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/wyvern.h"
+
+WYVERN_LAZY(1) int report(int verbose, int position);
+WYVERN_EAGER(0) int lookup(int key, int fallback);
+
+int report(int verbose, int position) {
+	return verbose + position;
+}
+
+int lookup(int key, int fallback) {
+	if (fallback) {
+		return -1;
+	}
+	return key;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: call i32 @_wyvern_calleeclone_report_1_
+// CHECK: call i32 @lookup(
+// CHECK-NOT: @_wyvern_calleeclone_lookup_
+// CHECK: define {{.*}}i32 @_wyvern_lazyentry_report_1(
+// CHECK-SAME: i32 %0, i8* %_wyvern_thunkptr)
+int caller(int verbose, int fallback, int x) {
+	int position = report(verbose, x * x + 7);
+	return position + lookup(x * 3 + 1, fallback);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <verbose> <value>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%d\n", caller(atoi(argv[1]), 0, atoi(argv[2])));
+	return 0;
+}
@@ -0,0 +1,52 @@
+// The position passed to report() is used once, outside of any loop, so its
+// thunk is evaluated at most once per call and is not memoized. The limit
+// passed to count_below() is used in every iteration of a loop, so its thunk
+// is memoized. Environments are kept out of registers, so that both thunks
+// are passed in memory.
+
+// OPT-FLAGS: -wylazy-register-env-size=0
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int report(int verbose, int position) {
+	if (verbose) {
+		return position;
+	}
+	return 0;
+}
+
+int count_below(int *values, int M, int limit) {
+	int count = 0;
+	for (int i = 0; i < M; i++) {
+		if (values[i] < limit) {
+			count++;
+		}
+	}
+	return count;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: store {{.*}} @_wyvern_slice_caller__
+// CHECK: call i32 @_wyvern_calleeclone_report_1_{{[0-9a-f]+}}(i32 %0,
+// CHECK-SAME: { i32 (i8*)* }* nonnull %_wyvern_thunk_header)
+// NOMEMO: store {{.*}} @_wyvern_slice_caller__
+// NOMEMO: call i32 @_wyvern_calleeclone_count_below_2_{{[0-9a-f]+}}(
+// NOMEMO-SAME: { i32 (i8*)* }* nonnull %_wyvern_thunk_header{{[0-9]*}})
+// MEMO: store {{.*}} @_wyvern_slice_memo_caller__
+// MEMO: call i32 @_wyvern_calleeclone_count_below_2_{{[0-9a-f]+}}(
+// MEMO-SAME: { i32 (i8*)*, i32 }* nonnull %_wyvern_thunk_header{{[0-9]*}})
+int caller(int verbose, int *values, int M, int x) {
+	return report(verbose, x * x + 7) + count_below(values, M, x * 3 + 1);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <verbose> <value>\n", argv[0]);
+		return 0;
+	}
+
+	int values[] = {3, 60, 12, 90, 45};
+	printf("%d\n", caller(atoi(argv[1]), values, 5, atoi(argv[2])));
+	return 0;
+}
@@ -0,0 +1,45 @@
+// The value passed to select() depends on the induction variable, which the
+// delegate could not recompute, and on half, which caller() also uses itself.
+// Both values are captured in the thunk environment when the thunk is
+// initialized, so the delegate only recomputes the rest of the expression,
+// and the call site can be lazified even though its slice varies per
+// iteration.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int select(int cond, int value) {
+	if (cond) {
+		return value;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: %[[HALF:[0-9]+]] = sdiv i32 %2, 2
+// CHECK: icmp slt i32 %[[I:[0-9]+]], %1
+// CHECK: insertvalue {{.*}} @_wyvern_slice_env_caller__{{.*}}, i32 %[[HALF]], 1
+// CHECK-NEXT: insertvalue {{.*}}, i32 %[[I]], 2
+// CHECK-NEXT: call i32 @_wyvern_calleeclone_select_1_
+// CHECK: define {{.*}}i32 @_wyvern_slice_env_caller__
+// CHECK-NOT: sdiv
+// CHECK: ret i32
+int caller(int *modes, int M, int n) {
+	int sum = 0;
+	int half = n / 2;
+	for (int i = 0; i < M; i++) {
+		sum += select(modes[i] == 1, i * half * (i + 3) + half);
+	}
+	return sum + half;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <value>\n", argv[0]);
+		return 0;
+	}
+
+	int modes[] = {1, 0, 1, 1, 0};
+	printf("%d\n", caller(modes, 5, atoi(argv[1])));
+	return 0;
+}
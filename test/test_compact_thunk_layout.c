@@ -0,0 +1,38 @@
+// The slice that computes the score passed to report() depends on arguments of
+// mixed sizes. Its thunk stores them in order of decreasing size, rather than
+// in the order they were found, and memoizes the score without a separate
+// flag, so the thunk has no padding between fields.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+double report(int verbose, double score) {
+	double total = 0;
+	for (int i = 0; i < verbose; i++) {
+		total += score;
+	}
+	return total;
+}
+
+// NOMEMO: %_wyvern_thunk_type = type { double (%_wyvern_thunk_type*)*,
+// NOMEMO-SAME: double, i32, i16, i8, i8 }
+// MEMO: %_wyvern_thunk_type{{.*}} = type { double (%_wyvern_thunk_type{{.*}})*,
+// MEMO-SAME: double, double, i32, i16, i8, i8 }
+// CHECK-LABEL: define {{.*}}double @caller(
+// NOMEMO: call double @_wyvern_calleeclone_report_1_{{[0-9a-f]+}}(i32 %0,
+// NOMEMO-SAME: { double (i8*)* }* nonnull %_wyvern_thunk_header)
+// MEMO: call double @_wyvern_calleeclone_report_1_{{[0-9a-f]+}}(i32 %0,
+// MEMO-SAME: { double (i8*)*, double }* nonnull %_wyvern_thunk_header)
+double caller(int verbose, char c, double value, short s, int n, char d) {
+	return report(verbose, (value * c - s + d) * n);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <verbose> <value>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%f\n", caller(atoi(argv[1]), 3, atof(argv[2]), 7, 11, 5));
+	return 0;
+}
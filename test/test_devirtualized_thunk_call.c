@@ -0,0 +1,38 @@
+// The clone of report() only ever receives the thunk created in caller(), so
+// it evaluates the thunk by calling the delegate function directly, rather
+// than through the function pointer stored in the thunk. The environment is
+// kept out of registers, so that the thunk is passed in memory.
+
+// OPT-FLAGS: -wylazy-register-env-size=0
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int report(int verbose, int position) {
+	if (verbose) {
+		return position;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: call i32 @_wyvern_calleeclone_report_1_
+// CHECK: define {{.*}}i32 @_wyvern_slice_caller__[[DELEGATE:[0-9a-f]+]](
+// CHECK: define {{.*}}i32 @_wyvern_calleeclone_report_1_
+// CHECK-NOT: call i32 %
+// CHECK: call i32 {{.*}}@_wyvern_slice_caller__[[DELEGATE]]
+// CHECK-NOT: call i32 %
+// CHECK: ret i32
+int caller(int verbose, int x) {
+	return report(verbose, x * x + 7);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <verbose> <value>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%d\n", caller(atoi(argv[1]), atoi(argv[2])));
+	return 0;
+}
@@ -0,0 +1,51 @@
+// Both callers lazify the same expression, with the same environment, in the
+// call to report(). The two delegate functions generated for them are
+// identical, so the second one is folded into the first, and both call sites
+// share a single delegate and a single clone of report(), which calls the
+// delegate directly.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int report(int verbose, int position) {
+	if (verbose) {
+		return position;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @first_caller(
+// CHECK: insertvalue { i32 (i32)*, i32 }
+// CHECK-SAME: @_wyvern_slice_env_first_caller__[[DELEGATE:[0-9a-f]+]]
+// CHECK: call i32 @_wyvern_calleeclone_report_1_[[CLONE:[0-9a-f]+]](i32 %0,
+int first_caller(int verbose, int x) {
+	return report(verbose, x * x + 7);
+}
+
+// CHECK-LABEL: define {{.*}}i32 @second_caller(
+// CHECK: insertvalue { i32 (i32)*, i32 }
+// CHECK-SAME: @_wyvern_slice_env_first_caller__[[DELEGATE]]
+// CHECK: call i32 @_wyvern_calleeclone_report_1_[[CLONE]](i32 %0,
+// CHECK-NOT: define {{.*}}@_wyvern_slice_env_second_caller__
+// CHECK: define {{.*}}i32 @_wyvern_slice_env_first_caller__[[DELEGATE]](i32
+// CHECK-NOT: define {{.*}}@_wyvern_slice_env_second_caller__
+// CHECK: define {{.*}}i32 @_wyvern_calleeclone_report_1_[[CLONE]](i32 %0,
+// CHECK-NOT: call i32 %
+// CHECK: call i32 @_wyvern_slice_env_first_caller__[[DELEGATE]](i32
+// CHECK-NOT: define {{.*}}@_wyvern_calleeclone_report_
+// CHECK-NOT: define {{.*}}@_wyvern_slice_env_second_caller__
+int second_caller(int verbose, int x) {
+	int result = report(verbose, x * x + 7);
+	return result + 1;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <verbose>\n", argv[0]);
+		return 0;
+	}
+
+	int verbose = atoi(argv[1]);
+	printf("%d\n", first_caller(verbose, 5) + second_caller(verbose, 6));
+	return 0;
+}
@@ -0,0 +1,44 @@
+// Interpreter-style dispatch through a table of handlers. The call in
+// dispatch() is indirect, so it can only be lazified once the profile shows
+// that most of its calls reach op_check, which is then promoted to a guarded
+// direct call. The direct call gets a clone of op_check, while the fallback
+// indirect call still receives the value.
+
+// OPT-FLAGS: -wylazy-pgo -wylazy-pgo-file=test_indirect_call_promotion.csv
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int (*handler_t)(int key, int value);
+
+int op_check(int key, int value) {
+	if (key != 0) {
+		return 0;
+	}
+	return value;
+}
+
+int op_add(int key, int value) {
+	return key + value;
+}
+
+handler_t handlers[] = {op_check, op_add};
+
+// CHECK-LABEL: define {{.*}}i32 @dispatch(
+// CHECK: icmp eq i32 (i32, i32)* %{{.*}}, @op_check
+// CHECK: call i32 @_wyvern_calleeclone_op_check_1_
+// CHECK: call i32 %{{.*}}(i32 %{{.*}}, i32 %{{.*}})
+// CHECK-LABEL: define {{.*}}i32 @_wyvern_calleeclone_op_check_1_
+int dispatch(int op, int key, int x) {
+	return handlers[op](key, x * x + 7);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s <op> <key> <value>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%d\n", dispatch(atoi(argv[1]), atoi(argv[2]), atoi(argv[3])));
+	return 0;
+}
@@ -0,0 +1,35 @@
+// report() is defined in lib/test_lazy_parameter_declaration.c, another
+// translation unit, so only its prototype is visible here.
+// Its position is annotated as lazy next to the prototype, so the call should
+// go through a lazy wrapper, which forwards the thunk to the entry point
+// emitted for the definition when both files are compiled with the pass.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/wyvern.h"
+
+int report(int verbose, int position);
+WYVERN_LAZY_DECL(report, 1);
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK-NOT: call i32 @report(
+// CHECK: call i32 @_wyvern_lazywrapper_report_1(
+int caller(int verbose, int x) {
+	return report(verbose, x * x + 7);
+}
+
+// CHECK: declare extern_weak i32 @_wyvern_lazyentry_report_1(i32, i8*)
+// CHECK: define internal i32 @_wyvern_lazywrapper_report_1(
+// CHECK: label %_wyvern_lazywrapper_lazy, label %_wyvern_lazywrapper_eager
+// CHECK: call i32 @_wyvern_lazyentry_report_1(
+// CHECK: call i32 @report(
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <verbose> <value>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%d\n", caller(atoi(argv[1]), atoi(argv[2])));
+	return 0;
+}
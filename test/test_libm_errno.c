@@ -0,0 +1,35 @@
+// The value passed to report() calls log(), which writes errno on domain
+// errors. Nothing reads errno after the call, so it is deferred to the delegate
+// function and erased from caller(). The delegate writes errno, so it must not
+// be marked as read-only.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int report(int verbose, double score) {
+	if (verbose) {
+		return (int)score;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK-NOT: call double @log(
+// CHECK: call i32 @_wyvern_calleeclone_report_
+// CHECK: define {{.*}}double @_wyvern_slice_{{.*}} #[[DELEGATE:[0-9]+]]
+// CHECK: call double @log(
+// CHECK: attributes #[[DELEGATE]] = { nounwind willreturn }
+int caller(int verbose, double x) {
+	return report(verbose, log(x) * 100.0);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <verbose> <value>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%d\n", caller(atoi(argv[1]), atof(argv[2])));
+	return 0;
+}
@@ -0,0 +1,60 @@
+// caller() stores size right before loading it back in the slice of the
+// lazified argument, and resets it only after the call. Neither store can
+// execute between the load and the points where the thunk is forced, and
+// select() does not write to size, so the load is deferred to the delegate.
+// select_and_reset() writes to size before it may force the thunk, so the
+// load in clobbered_caller() must stay before the call.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int size;
+
+int select(int cond, int value) {
+	if (cond) {
+		return value;
+	}
+	return 0;
+}
+
+int select_and_reset(int cond, int value) {
+	size = -1;
+	if (cond) {
+		return value;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: store i32 %1, i32* @size
+// CHECK-NOT: load i32, i32* @size
+// CHECK: call i32 @_wyvern_calleeclone_select_1_
+// CHECK: store i32 0, i32* @size
+int caller(int mode, int n) {
+	size = n;
+	int result = select(mode == 1, size * size + 7);
+	size = 0;
+	return result;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @clobbered_caller(
+// CHECK: call i32 @select_and_reset(
+// CHECK: define {{.*}}i32 @_wyvern_slice_caller__
+// CHECK: load i32, i32* @size
+// CHECK-NOT: @_wyvern_calleeclone_select_and_reset_
+int clobbered_caller(int mode, int n) {
+	size = n;
+	return select_and_reset(mode == 1, size * size + 7);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <mode> <size>\n", argv[0]);
+		return 0;
+	}
+
+	int mode = atoi(argv[1]);
+	int n = atoi(argv[2]);
+	printf("%d\n", caller(mode, n) + clobbered_caller(mode, n));
+	return 0;
+}
@@ -0,0 +1,45 @@
+// The value passed to select() is loop-invariant, but it is computed inside
+// the loop and only used by select() on some iterations. The thunk for it is
+// initialized once, before the loop, and memoized when memoization is enabled,
+// so that the value is computed at most once, no matter how many iterations
+// need it. The thunk stays alive until caller() returns.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int select(int cond, int value) {
+	if (cond) {
+		return value;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: call void @llvm.lifetime.start.p0i8(
+// NOMEMO: store {{.*}} @_wyvern_slice_caller__
+// MEMO: store {{.*}} @_wyvern_slice_memo_caller__
+// CHECK: phi i32
+// CHECK-NOT: store {{.*}} @_wyvern_slice_
+// CHECK: call i32 @_wyvern_calleeclone_select_1_
+// CHECK-NOT: call void @llvm.lifetime.end.p0i8(
+// CHECK: br label
+// CHECK: call void @llvm.lifetime.end.p0i8(
+// CHECK-NEXT: ret i32
+int caller(int *modes, int M, int x) {
+	int sum = 0;
+	for (int i = 0; i < M; i++) {
+		sum += select(modes[i] == 1, x * x + 7);
+	}
+	return sum;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <value>\n", argv[0]);
+		return 0;
+	}
+
+	int modes[] = {1, 0, 1, 1, 0};
+	printf("%d\n", caller(modes, 5, atoi(argv[1])));
+	return 0;
+}
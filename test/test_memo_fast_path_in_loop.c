@@ -0,0 +1,48 @@
+// The lazified threshold is used in every iteration of the loop in
+// count_above(). With memoization, the clone checks the memoization flag of
+// the thunk inline: a hit loads the memoized value from the thunk, and only a
+// miss calls the delegate function, which is marked cold.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int count_above(int *values, int M, int threshold) {
+	int count = 0;
+	for (int i = 0; i < M; i++) {
+		if (values[i] > threshold) {
+			count++;
+		}
+	}
+	return count;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: call i32 @_wyvern_calleeclone_count_above_2_
+// MEMO: define {{.*}}i32 @_wyvern_calleeclone_count_above_2_
+// NOMEMO-NOT: _wyvern_memo_flag
+// MEMO: %_wyvern_thunkfptr = load
+// MEMO: %_wyvern_memo_flag = icmp eq {{.*}} @_wyvern_memo_ret_i32_
+// MEMO: br i1 %_wyvern_memo_flag, label %_wyvern_memo_hit,
+// MEMO-SAME: label %_wyvern_memo_miss, !prof
+// MEMO: _wyvern_memo_hit:
+// MEMO: %_wyvern_memo_val = load i32
+// MEMO: _wyvern_memo_miss:
+// MEMO: %_wyvern_thunkcall = call i32 {{.*}} #[[COLD:[0-9]+]]
+// MEMO: _wyvern_memo_join:
+// MEMO: phi i32 [ %_wyvern_memo_val, %_wyvern_memo_hit ],
+// MEMO-SAME: [ %_wyvern_thunkcall, %_wyvern_memo_miss ]
+// MEMO: attributes #[[COLD]] = { cold noinline }
+int caller(int *values, int M, int x) {
+	return count_above(values, M, x * x + 7);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <value>\n", argv[0]);
+		return 0;
+	}
+
+	int values[] = {3, 60, 12, 90, 45};
+	printf("%d\n", caller(values, 5, atoi(argv[1])));
+	return 0;
+}
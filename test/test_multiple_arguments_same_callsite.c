@@ -0,0 +1,36 @@
+// Both values computed in caller() are only used by select() on some paths,
+// so the call site is lazified in terms of both arguments: select() is cloned
+// once per lazified argument, and the call site ends up calling a single clone
+// that receives a thunk for each of them. The intermediate clone is erased.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int select(int mode, int first, int second) {
+	if (mode == 1) {
+		return first;
+	} else if (mode == 2) {
+		return second;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: call i32 @_wyvern_calleeclone_select_1_2_{{[0-9a-f]+}}(i32 %0,
+// CHECK-SAME: %_wyvern_env, { i32 (i32)*, i32 } %_wyvern_env1)
+// CHECK-NOT: define {{.*}}@_wyvern_calleeclone_select_{{[12]}}_{{[0-9a-f]+}}(
+// CHECK: define {{.*}}@_wyvern_calleeclone_select_1_2_
+// CHECK-NOT: define {{.*}}@_wyvern_calleeclone_select_{{[12]}}_{{[0-9a-f]+}}(
+int caller(int mode, int x) {
+	return select(mode, x * x + 7, x * x * x + 1);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <mode> <value>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%d\n", caller(atoi(argv[1]), atoi(argv[2])));
+	return 0;
+}
@@ -0,0 +1,41 @@
+// The slice that computes the bound passed to clamp() only depends on two
+// scalar arguments of caller(). Instead of storing them in a thunk on the
+// stack, caller() passes them to a clone of clamp() in registers, along with
+// the delegate function, which the clone calls on them.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int clamp(int value, int bound) {
+	if (value > 100) {
+		return bound;
+	}
+	return value;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK-NOT: alloca
+// CHECK: insertvalue { i32 (i32, i32)*, i32, i32 }
+// CHECK-SAME: @_wyvern_slice_env_caller__[[DELEGATE:[0-9a-f]+]]
+// CHECK: call i32 @_wyvern_calleeclone_clamp_1_{{[0-9a-f]+}}(i32 %0,
+// CHECK-SAME: { i32 (i32, i32)*, i32, i32 } %_wyvern_env{{[0-9]*}})
+// CHECK: define {{.*}}i32 @_wyvern_slice_env_caller__[[DELEGATE]](i32
+// CHECK-SAME: #[[ATTRS:[0-9]+]]
+// CHECK: define {{.*}}i32 @_wyvern_calleeclone_clamp_1_
+// CHECK-SAME: (i32 %0, { i32 (i32, i32)*, i32, i32 } %_wyvern_env)
+// CHECK-NOT: alloca
+// CHECK: call i32 @_wyvern_slice_env_caller__[[DELEGATE]](i32
+// CHECK: attributes #[[ATTRS]] = { nounwind readnone willreturn }
+int caller(int value, int a, int b) {
+	return clamp(value, a * b + a);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <value> <bound>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%d\n", caller(atoi(argv[1]), atoi(argv[2]), 2));
+	return 0;
+}
@@ -0,0 +1,50 @@
+// The position computed in caller() is lazified in the call to report(), and
+// also used twice by caller() itself, on paths that are rarely taken. Both of
+// these uses evaluate the thunk. Since delegate functions are idempotent, the
+// second evaluation, which the first dominates, reuses the value of the first.
+// Plain delegates only read their thunk, while memoized delegates also write
+// the memoized value to it, so they are not read-only.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int report(int verbose, int position) {
+	if (verbose) {
+		return position;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: call i32 @_wyvern_calleeclone_report_1_
+// CHECK: %[[VALUE:_wyvern_thunkcall[0-9]*]] = call i32 @_wyvern_slice_
+// CHECK-NOT: call i32 @_wyvern_slice_
+// CHECK: xor i32 %{{[0-9]+}}, %[[VALUE]]
+// CHECK-NOT: call i32 @_wyvern_slice_
+// CHECK: ret i32
+// NOMEMO: define {{.*}}@_wyvern_slice_caller__{{.*}} #[[ATTRS:[0-9]+]]
+// MEMO: define {{.*}}@_wyvern_slice_memo_caller__{{.*}} #[[ATTRS:[0-9]+]]
+// CHECK-SAME: !wyvern.idempotent
+// NOMEMO: attributes #[[ATTRS]] = { argmemonly nounwind readonly willreturn }
+// MEMO: attributes #[[ATTRS]] = { argmemonly nounwind willreturn }
+int caller(int verbose, int x) {
+	int position = x * x + 7;
+	int result = report(verbose, position);
+	if (result > 10) {
+		result += position * 3;
+		if (result > 100) {
+			result ^= position;
+		}
+	}
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <verbose> <value>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%d\n", caller(atoi(argv[1]), atoi(argv[2])));
+	return 0;
+}
@@ -0,0 +1,43 @@
+// Both callers lazify the position passed to report(), with slices that have
+// different environments. Since the clone of report() only accesses the
+// canonical thunk header, both call sites share a single clone. Environments
+// are kept out of registers, so that both thunks are passed in memory.
+
+// OPT-FLAGS: -wylazy-register-env-size=0
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int report(int verbose, int position) {
+	if (verbose) {
+		return position;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @first_caller(
+// CHECK: call i32 @_wyvern_calleeclone_report_1_[[CLONE:[0-9a-f]+]](
+int first_caller(int verbose, int x) {
+	return report(verbose, x * x + 7);
+}
+
+// CHECK-LABEL: define {{.*}}i32 @second_caller(
+// CHECK: call i32 @_wyvern_calleeclone_report_1_[[CLONE]](
+int second_caller(int verbose, int x, int y, int z) {
+	return report(verbose, x * y + z);
+}
+
+// CHECK: define {{.*}}i32 @_wyvern_calleeclone_report_1_[[CLONE]](
+// CHECK-SAME: i32 %0, { i32 (i8*)* }* %_wyvern_thunkptr)
+// CHECK-NOT: define {{.*}}@_wyvern_calleeclone_report_
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <verbose> <value>\n", argv[0]);
+		return 0;
+	}
+
+	int x = atoi(argv[2]);
+	int verbose = atoi(argv[1]);
+	printf("%d\n", first_caller(verbose, x) + second_caller(verbose, x, 2, 3));
+	return 0;
+}
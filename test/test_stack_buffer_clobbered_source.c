@@ -0,0 +1,60 @@
+// The name is copied into a local buffer right before being passed to
+// rename_user(), which changes the name it was copied from before reading
+// the message. Migrating the strcpy into the delegate would copy the new
+// name, so the call should not be lazified. greet_user() only writes to
+// another global before reading the message, so the strcpy in
+// greeting_caller() is migrated to the delegate when memoization is enabled.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char name[16] = "alice";
+int greeted;
+
+int rename_user(int verbose, char *message) {
+	if (verbose) {
+		name[0] = 'b';
+		return message[0];
+	}
+	return 0;
+}
+
+int greet_user(int verbose, char *message) {
+	if (verbose) {
+		greeted++;
+		return message[0];
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: call i8* @strcpy(
+// CHECK: call i32 @rename_user(
+int caller(int mode) {
+	char message[16];
+	strcpy(message, name);
+	return rename_user(mode == 1, message);
+}
+
+// CHECK-LABEL: define {{.*}}i32 @greeting_caller(
+// NOMEMO: call i8* @strcpy(
+// NOMEMO: call i32 @greet_user(
+// MEMO-NOT: @strcpy(
+// MEMO: call i32 @_wyvern_calleeclone_greet_user_1_
+int greeting_caller(int mode) {
+	char message[16];
+	strcpy(message, name);
+	return greet_user(mode == 1, message);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <mode>\n", argv[0]);
+		return 0;
+	}
+
+	int mode = atoi(argv[1]);
+	printf("%d\n", greeting_caller(mode) + caller(mode));
+	return 0;
+}
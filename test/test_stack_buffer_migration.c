@@ -0,0 +1,41 @@
+// The message is built in a local buffer right before being passed to
+// report(), which only prints it on some paths. The buffer does not escape
+// before the call, so the snprintf that builds it is moved to the delegate
+// function, which fills the buffer of the caller when report() forces the
+// thunk. The delegate writes to the buffer, so the call site is only
+// lazified with memoization.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int report(int verbose, char *message) {
+	if (verbose) {
+		puts(message);
+		return 1;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// NOMEMO: call i32 {{.*}} @snprintf(
+// NOMEMO: call i32 @report(
+// MEMO: %[[BUFFER:[0-9]+]] = alloca [64 x i8]
+// MEMO-NOT: @snprintf(
+// MEMO: store [64 x i8]* %[[BUFFER]], [64 x i8]** %_wyvern_thunk_arg_gep_
+// MEMO: call i32 @_wyvern_calleeclone_report_1_
+// MEMO: define {{.*}}i8* @_wyvern_slice_memo_caller__
+// MEMO: call i32 {{.*}} @snprintf(
+int caller(int mode, int x) {
+	char message[64];
+	snprintf(message, sizeof(message), "value %d", x * x + 7);
+	return report(mode == 1, message);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <mode> <value>\n", argv[0]);
+		return 0;
+	}
+
+	return caller(atoi(argv[1]), atoi(argv[2]));
+}
@@ -0,0 +1,44 @@
+// The position computed in caller() is passed through middle() to leaf(),
+// and only used by leaf() when verbose is set. With -wylazy-forward-thunks,
+// the clone of middle() passes the thunk on to a clone of leaf(), instead of
+// evaluating it before the call.
+
+// OPT-FLAGS: -wylazy-forward-thunks
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int leaf(int verbose, int position) {
+	if (verbose > 1) {
+		return position;
+	}
+	return 0;
+}
+
+int middle(int verbose, int position) {
+	if (verbose) {
+		return leaf(verbose, position);
+	}
+	return -1;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK: call i32 @_wyvern_calleeclone_middle_1_
+// CHECK: define {{.*}}i32 @_wyvern_calleeclone_middle_1_
+// CHECK-NOT: _wyvern_thunkcall
+// CHECK: call i32 @_wyvern_calleeclone_leaf_1_
+// CHECK: define {{.*}}i32 @_wyvern_calleeclone_leaf_1_
+// CHECK: _wyvern_thunkcall
+int caller(int verbose, int x) {
+	return middle(verbose, x * x + 7);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <verbose> <value>\n", argv[0]);
+		return 0;
+	}
+
+	printf("%d\n", caller(atoi(argv[1]), atoi(argv[2])));
+	return 0;
+}
@@ -0,0 +1,48 @@
+// caller() lazifies two independent call sites whose thunks are only passed to
+// the call. Each thunk is marked alive from its initialization up to the end
+// of its call, so the backend can place both thunks in the same stack slot
+// instead of keeping one slot per call site for the whole frame. Environments
+// are kept out of registers, so that both thunks are passed in memory.
+
+// OPT-FLAGS: -wylazy-register-env-size=0
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int maybe(int cond, int value) {
+	if (cond) {
+		return value;
+	}
+	return 0;
+}
+
+// CHECK-LABEL: define {{.*}}i32 @caller(
+// CHECK-NEXT: %_wyvern_thunk_alloca{{[0-9]*}} = alloca
+// CHECK-NEXT: %_wyvern_thunk_alloca{{[0-9]*}} = alloca
+// CHECK-NOT: call i32 @_wyvern_calleeclone_maybe_1_
+// CHECK: call void @llvm.lifetime.start.p0i8(i64 16,
+// CHECK: call i32 @_wyvern_calleeclone_maybe_1_
+// CHECK-NEXT: bitcast
+// CHECK-NEXT: call void @llvm.lifetime.end.p0i8(i64 16,
+// CHECK-NOT: call i32 @_wyvern_calleeclone_maybe_1_
+// CHECK: call void @llvm.lifetime.start.p0i8(i64 16,
+// CHECK: call i32 @_wyvern_calleeclone_maybe_1_
+// CHECK-NEXT: bitcast
+// CHECK-NEXT: call void @llvm.lifetime.end.p0i8(i64 16,
+// CHECK: ret i32
+int caller(int mode, int x, int y) {
+	int first = maybe(mode == 1, x * x + 7);
+	int second = maybe(mode == 2, y * y + first);
+	return first + second;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <mode> <value>\n", argv[0]);
+		return 0;
+	}
+
+	int x = atoi(argv[2]);
+	printf("%d\n", caller(atoi(argv[1]), x, x + 1));
+	return 0;
+}
@@ -0,0 +1,46 @@
+// The formatted value is only needed when the log level is enabled. Since
+// log_debug does nothing but read the global level before va_start, the
+// variadic argument can be lazified and evaluated just before va_start. Both
+// callers pass an int after the format, so they share one clone of log_debug.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int log_level = 2;
+
+void log_debug(int level, const char *fmt, ...) {
+	if (level < log_level) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+// CHECK-LABEL: define {{.*}}void @first_caller(
+// CHECK: call void @_wyvern_calleeclone_log_debug_2_[[CLONE:[0-9a-f]+]](
+void first_caller(int level, int x) {
+	log_debug(level, "square = %d\n", x * x + 7);
+}
+
+// CHECK-LABEL: define {{.*}}void @second_caller(
+// CHECK: call void @_wyvern_calleeclone_log_debug_2_[[CLONE]](
+void second_caller(int level, int x) {
+	log_debug(level, "cube = %d\n", x * x * x + 1);
+}
+
+// CHECK: define {{.*}}void @_wyvern_calleeclone_log_debug_2_[[CLONE]](
+// CHECK-SAME: i32 %0, i8* %1, { i32 (i8*)* }* %_wyvern_thunkptr)
+// CHECK-NOT: define {{.*}}@_wyvern_calleeclone_log_debug_
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <level> <value>\n", argv[0]);
+		return 0;
+	}
+
+	first_caller(atoi(argv[1]), atoi(argv[2]));
+	second_caller(atoi(argv[1]), atoi(argv[2]));
+	return 0;
+}
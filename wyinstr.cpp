@@ -6,6 +6,7 @@
 #include <memory>
 #include <mutex>
 #include <stack>
+#include <string>
 
 using callsite_id = std::pair<const char *, int64_t>;
 
@@ -19,7 +20,9 @@ size_t hash_c_string(const char *p, size_t s) {
 }
 
 struct prof_report {
-  prof_report(int8_t num_args) : _num_calls(1), _num_args(num_args) {
+  prof_report(int8_t num_args)
+      : _num_calls(1), _num_args(num_args), _indirect(false),
+        _pending_target(false) {
     _unique_arg_evals = (int64_t *)calloc(num_args, sizeof(int64_t));
     _arg_evals = (int64_t *)calloc(num_args, sizeof(int64_t));
   }
@@ -33,6 +36,11 @@ struct prof_report {
   int8_t _num_args;
   int64_t *_unique_arg_evals;
   int64_t *_arg_evals;
+
+  // value profile of the targets reached from an indirect callsite
+  bool _indirect;
+  bool _pending_target;
+  std::map<std::string, int64_t> _targets;
 };
 
 static bool initialized = false;
@@ -94,6 +102,42 @@ _wyinstr_init_call(const char *fun_name, int64_t callinstr_id,
 #endif
 }
 
+extern "C" void __attribute__((noinline))
+_wyinstr_init_icall(const char *fun_name, int64_t callinstr_id,
+                    int8_t num_args) {
+  std::lock_guard<std::recursive_mutex> lock(wyinstr_mutex);
+  if (!initialized) {
+    return;
+  }
+
+  _wyinstr_init_call(fun_name, callinstr_id, num_args);
+
+  // the next instrumented function entered is the target of this call
+  struct prof_report *report = profile_info[call_stack.top()].get();
+  report->_indirect = true;
+  report->_pending_target = true;
+}
+
+extern "C" __attribute__((noinline)) void
+_wyinstr_mark_target(const char *callee_name) {
+  std::lock_guard<std::recursive_mutex> lock(wyinstr_mutex);
+  if (!initialized) {
+    return;
+  }
+
+  struct prof_report *report = profile_info[call_stack.top()].get();
+  if (!report->_indirect || !report->_pending_target) {
+    return;
+  }
+#ifdef DEBUG
+  fprintf(stderr, "Indirect call from <%s, %li> reached target %s\n",
+          call_stack.top().first, call_stack.top().second, callee_name);
+#endif
+
+  report->_pending_target = false;
+  report->_targets[callee_name] += 1;
+}
+
 extern "C" __attribute__((noinline)) void _wyinstr_mark_eval(int8_t arg_index,
                                                              int64_t *bits) {
   std::lock_guard<std::recursive_mutex> lock(wyinstr_mutex);
@@ -121,6 +165,20 @@ extern "C" __attribute__((noinline)) void _wyinstr_mark_eval(int8_t arg_index,
 #endif
 }
 
+extern "C" __attribute__((noinline)) void
+_wyinstr_mark_vaeval(int8_t first_index, int64_t *bits) {
+  std::lock_guard<std::recursive_mutex> lock(wyinstr_mutex);
+  if (!initialized) {
+    return;
+  }
+
+  // va_start makes every variadic argument of the active call available
+  struct prof_report *report = profile_info[call_stack.top()].get();
+  for (int8_t i = first_index; i < report->_num_args; ++i) {
+    _wyinstr_mark_eval(i, bits);
+  }
+}
+
 extern "C" __attribute__((noinline)) int64_t _wyinstr_initbits() {
   return static_cast<int64_t>(0);
 }
@@ -150,7 +208,8 @@ extern "C" __attribute__((noinline)) void _wyinstr_dump(const char *mod_name) {
   std::string filename = std::string(mod_name) + ".csv";
   FILE *outfile = fopen(filename.c_str(), "w");
   fprintf(outfile,
-          "fun_name,call_id,total_calls,num_args,unique_evals,total_evals\n");
+          "fun_name,call_id,total_calls,num_args,unique_evals,total_evals,"
+          "targets\n");
   for (auto &[key, value] : profile_info) {
     fprintf(outfile, "%s,%li,%li,%d,", key.first, key.second, value->_num_calls,
             value->_num_args);
@@ -160,6 +219,9 @@ extern "C" __attribute__((noinline)) void _wyinstr_dump(const char *mod_name) {
     for (int8_t i = 0; i < value->_num_args; ++i) {
       fprintf(outfile, "%li,", value->_arg_evals[i]);
     }
+    for (auto &[target, count] : value->_targets) {
+      fprintf(outfile, "%s:%li,", target.c_str(), count);
+    }
     fprintf(outfile, "\n");
     fflush(outfile);
   }